@@ -0,0 +1,146 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Settings every batch worker reads to build its variant
+typedef struct BatchPlan {
+    double spread;
+    unsigned int seed;
+} BatchPlan;
+
+static void batch_setup(Manager *manager, int variant, void *context);
+static int batch_perturb(unsigned int *state, int value, double spread);
+
+/**
+ * Runs many randomized variants of the loaded scenario in forked workers.
+ *
+ * The scenario is loaded (and indexed) once in this process. Each worker is forked from
+ * it, shares every page it does not write with the parent copy-on-write, randomizes the
+ * scenario's numeric parameters by up to `spread` with its own seed, runs it and reports
+ * through the shared results table. Variant 0 is the unchanged scenario. The destination
+ * resource is never randomized, so every variant's time to destination is for the same trip.
+ *
+ * @param[in,out] manager        Pointer to the loaded `Manager`; its time limit applies to each variant.
+ * @param[in]     variant_count  Number of variants to run.
+ * @param[in]     spread         Largest relative change of each parameter, e.g. 0.2 for +/-20%.
+ * @param[in]     jobs           Largest number of workers running at once.
+ * @param[in]     seed           Base seed; variant `i` uses `seed + i`.
+ */
+void batch_run(Manager *manager, int variant_count, double spread, int jobs, unsigned int seed) {
+    BatchPlan plan;
+    RunResult *results;
+    struct rusage usage;
+    int counts[OUTCOME_STALLED + 1] = {0};
+    long long arrival_total = 0, arrival_min = 0, arrival_max = 0;
+    long faults_total = 0, rss_max = 0;
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    if (variant_count <= 0) {
+        return;
+    }
+
+    results = (RunResult *)malloc(variant_count * sizeof(RunResult));
+    if (results == NULL) {
+        fprintf(stderr, "Failed to allocate memory for batch results.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    plan.spread = spread;
+    plan.seed = seed;
+    manager->display = 0;
+    simulation_prepare(manager);
+
+    printf("Running %d variants (+/-%.0f%%, %d at a time)...\n", variant_count, spread * 100, jobs);
+    runner_run_variants(manager, variant_count, jobs, batch_setup, &plan, results);
+
+    for (int i = 0; i < variant_count; i++) {
+        RunResult *result = &results[i];
+
+        counts[(result->outcome >= 0 && result->outcome <= OUTCOME_STALLED) ? result->outcome : OUTCOME_FAILED]++;
+        if (result->outcome == OUTCOME_DESTINATION) {
+            // counts already includes this arrival, so the first one sets the minimum
+            if (counts[OUTCOME_DESTINATION] == 1 || result->elapsed_ms < arrival_min) {
+                arrival_min = result->elapsed_ms;
+            }
+            if (result->elapsed_ms > arrival_max) {
+                arrival_max = result->elapsed_ms;
+            }
+            arrival_total += result->elapsed_ms;
+        }
+        faults_total += result->worker_faults;
+        if (result->worker_rss_kb > rss_max) {
+            rss_max = result->worker_rss_kb;
+        }
+    }
+
+    printf("Outcomes:");
+    for (int outcome = OUTCOME_DESTINATION; outcome <= OUTCOME_STALLED; outcome++) {
+        if (counts[outcome] > 0) {
+            printf(" %s %d", outcome_name(outcome), counts[outcome]);
+        }
+    }
+    printf("\n");
+    if (counts[OUTCOME_DESTINATION] > 0) {
+        printf("Time to destination: min %lld ms, mean %lld ms, max %lld ms\n",
+               arrival_min, arrival_total / counts[OUTCOME_DESTINATION], arrival_max);
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("Parent peak RSS %ld KB; each worker copied or touched %ld KB on average (peak RSS %ld KB including shared pages)\n",
+           usage.ru_maxrss, faults_total / variant_count * page_kb, rss_max);
+
+    free(results);
+}
+
+/**
+ * `VariantSetup` for the batch, randomizes the worker's copy of the scenario and reseeds its processing times.
+ *
+ * @param[in,out] manager  Pointer to the worker's copy of the `Manager`.
+ * @param[in]     variant  The variant this worker runs.
+ * @param[in]     context  Pointer to the `BatchPlan`.
+ */
+static void batch_setup(Manager *manager, int variant, void *context) {
+    BatchPlan *plan = (BatchPlan *)context;
+    unsigned int state = plan->seed + (unsigned int)variant;
+
+    simulation_seed(manager, state);
+    if (variant == 0) {
+        return;
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        system->processing_time = batch_perturb(&state, system->processing_time, plan->spread);
+        system->consumed.amount = batch_perturb(&state, system->consumed.amount, plan->spread);
+        system->produced.amount = batch_perturb(&state, system->produced.amount, plan->spread);
+    }
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        Resource *resource = manager->resource_array.resources[i];
+        int amount;
+
+        // Its capacity and starting amount are the trip, which every variant must share
+        if (resource->role == RESOURCE_ROLE_DESTINATION) {
+            continue;
+        }
+        resource->max_capacity = batch_perturb(&state, resource->max_capacity, plan->spread);
+        amount = batch_perturb(&state, atomic_load(&resource->amount), plan->spread);
+        atomic_store(&resource->amount, (amount < resource->max_capacity) ? amount : resource->max_capacity);
+    }
+}
+
+/**
+ * Moves a value by a random amount of up to `spread` of itself, never below zero.
+ *
+ * @param[in,out] state   State for `rand_r`.
+ * @param[in]     value   The value to perturb.
+ * @param[in]     spread  Largest relative change.
+ * @return                The perturbed value.
+ */
+static int batch_perturb(unsigned int *state, int value, double spread) {
+    double factor = 1.0 + spread * (2.0 * rand_r(state) / RAND_MAX - 1.0);
+    int perturbed = (int)(value * factor + 0.5);
+
+    return (perturbed < 0) ? 0 : perturbed;
+}
@@ -0,0 +1,282 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Benchmark for the resource synchronization strategies.
+// Every thread alternates between consuming and storing a single unit on one shared resource,
+// so the resource's amount sees the heaviest contention possible.
+// Also times drawing processing times from each distribution, which systems do once per conversion,
+// writing trace-sized records through each output backend, and compressing and decompressing
+// a trace shaped like a long run's.
+//
+// Usage: ./bench [threads] [operations_per_thread]
+
+#define BENCH_DEFAULT_THREADS    32
+#define BENCH_DEFAULT_OPERATIONS 200000
+#define BENCH_TRACE_SOURCES      12      // Periodic (system, resource, status) reporters in the synthetic trace
+
+typedef struct BenchWorker {
+    Resource *resource;
+    int operations;
+    int failures;   // Consumes that found the resource empty or stores that found it full
+} BenchWorker;
+
+/**
+ * Thread function for a benchmark worker.
+ *
+ * @param[in,out] arg  Pointer to the `BenchWorker` describing this thread's work.
+ * @return             NULL
+ */
+static void *bench_worker(void *arg) {
+    BenchWorker *worker = (BenchWorker *)arg;
+
+    for (int i = 0; i < worker->operations; i++) {
+        if ((i & 1) == 0) {
+            if (resource_consume(worker->resource, 1) != STATUS_OK) {
+                worker->failures++;
+            }
+        } else {
+            if (resource_store(worker->resource, 1) != 1) {
+                worker->failures++;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs the benchmark for a single synchronization strategy and prints the result.
+ *
+ * @param[in] label       Name of the strategy to print.
+ * @param[in] sync_mode   One of the `RESOURCE_SYNC_*` strategies.
+ * @param[in] threads     Number of worker threads.
+ * @param[in] operations  Number of operations for each thread.
+ */
+static void bench_run(const char *label, int sync_mode, int threads, int operations) {
+    Resource *resource;
+    pthread_t tids[threads];
+    BenchWorker workers[threads];
+    struct timespec start, end;
+    double elapsed_ns;
+    long total_operations = (long)threads * operations;
+    int failures = 0;
+
+    // Start half full so neither consumers nor producers are starved
+    resource_create(&resource, label, threads * 2, threads * 4);
+    resource_set_sync_mode(resource, sync_mode);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; i++) {
+        workers[i].resource = resource;
+        workers[i].operations = operations;
+        workers[i].failures = 0;
+        if (pthread_create(&tids[i], NULL, bench_worker, &workers[i]) != 0) {
+            perror("Failed to create benchmark thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        failures += workers[i].failures;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-8s: %10.2f ms total, %8.1f ns/op, %d failed ops, final amount %d\n",
+           label, elapsed_ns / 1e6, elapsed_ns / total_operations, failures, atomic_load(&resource->amount));
+
+    resource_destroy(resource);
+}
+
+/**
+ * Times drawing processing times from one distribution and prints the cost of a draw.
+ *
+ * @param[in] label         Name of the distribution to print.
+ * @param[in] distribution  One of the `PROCESSING_*` distributions.
+ * @param[in] draws         Number of draws.
+ */
+static void bench_random(const char *label, int distribution, int draws) {
+    RandomStream stream;
+    struct timespec start, end;
+    double elapsed_ns;
+    long long total = 0;
+
+    random_stream_init(&stream, 1, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < draws; i++) {
+        total += random_processing_time(&stream, distribution, 50, 10);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-12s: %8.1f ns/draw, mean %.2f ms\n", label, elapsed_ns / draws, (double)total / draws);
+}
+
+/**
+ * Times writing trace records to a file through one output backend.
+ *
+ * Prints the producer's cost per record, also as a share of the time budget of a record
+ * at one million records per second.
+ *
+ * @param[in] label      Name of the backend to print.
+ * @param[in] use_uring  Non-zero for io_uring, zero for the pwrite thread.
+ * @param[in] records    Number of records.
+ */
+static void bench_output(const char *label, int use_uring, int records) {
+    const char *path = "bench.out";
+    OutputWriter writer;
+    OutputStream *stream;
+    TraceRecord record;
+    struct timespec start, end;
+    double elapsed_ns;
+
+    output_init(&writer, use_uring);
+    stream = output_open(&writer, path);
+    if (stream == NULL) {
+        perror("Failed to open benchmark output");
+        output_clean(&writer);
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < records; i++) {
+        record.time_ns = i;
+        record.amount = i;
+        output_write(stream, &record, sizeof(record));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    output_close(stream);
+
+    elapsed_ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-8s: %8.1f ns/record (%.2f%% of 1M records/s), %.0f MB/s, %lld writes in %lld submissions (%s)\n",
+           label, elapsed_ns / records, elapsed_ns / records / 10.0, records * sizeof(record) / (elapsed_ns / 1e3),
+           writer.writes, writer.submit_calls, output_backend_name(&writer));
+    output_clean(&writer);
+    unlink(path);
+}
+
+/**
+ * Fills `records` with a synthetic trace: a few reporters, each repeating one event every
+ * 20 to 200 ms with normally distributed jitter, and now and then a different amount.
+ *
+ * @param[out] records  Array of `count` records to fill.
+ * @param[in]  count    Number of records.
+ */
+static void bench_trace_records(TraceRecord *records, int count) {
+    RandomStream stream;
+    TraceRecord sources[BENCH_TRACE_SOURCES];
+    int64_t next[BENCH_TRACE_SOURCES], period[BENCH_TRACE_SOURCES];
+
+    random_stream_init(&stream, 1, 1);
+    for (int s = 0; s < BENCH_TRACE_SOURCES; s++) {
+        memset(&sources[s], 0, sizeof(sources[s]));
+        sources[s].system = (int16_t)((s % 4 == 0) ? -1 : s / 2);
+        sources[s].resource = (int16_t)(s % 5);
+        sources[s].status = (int16_t)(s % 4);
+        sources[s].priority = (int16_t)((s % 4 == 0) ? 2 : 1);
+        sources[s].amount = 10 + s;
+        period[s] = (20 + (int64_t)(random_uniform(&stream) * 180)) * 1000000LL;
+        next[s] = period[s];
+    }
+
+    for (int i = 0; i < count; i++) {
+        int s = 0;
+
+        for (int j = 1; j < BENCH_TRACE_SOURCES; j++) {
+            if (next[j] < next[s]) {
+                s = j;
+            }
+        }
+        records[i] = sources[s];
+        records[i].time_ns = next[s];
+        if (random_uniform(&stream) < 0.1) {
+            sources[s].amount += (random_uniform(&stream) < 0.5) ? -1 : 1;
+            records[i].amount = sources[s].amount;
+        }
+        next[s] += period[s] + (int64_t)(random_normal(&stream) * 20000.0);
+    }
+}
+
+/**
+ * Times compressing and decompressing a trace with the trace codec and checks the round trip.
+ *
+ * @param[in] records  Number of records.
+ */
+static void bench_codec(int records) {
+    TraceRecord *input = (TraceRecord *)malloc(records * sizeof(TraceRecord));
+    unsigned char *encoded = (unsigned char *)malloc((size_t)records * TRACE_RECORD_MAX_BYTES);
+    TraceCodec codec;
+    TraceRecord record;
+    struct timespec start, middle, end;
+    double encode_ns, decode_ns;
+    size_t size = 0, offset = 0;
+    int mismatches = 0;
+
+    if (input == NULL || encoded == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the codec benchmark.\n");
+        exit(EXIT_FAILURE);
+    }
+    bench_trace_records(input, records);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace_codec_init(&codec, TRACE_TIME_UNIT_NS);
+    for (int i = 0; i < records; i++) {
+        size += trace_encode(&codec, &input[i], encoded + size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    trace_codec_init(&codec, TRACE_TIME_UNIT_NS);
+    for (int i = 0; i < records; i++) {
+        offset += trace_decode(&codec, encoded + offset, encoded + size, &record);
+        mismatches += (record.time_ns != input[i].time_ns / TRACE_TIME_UNIT_NS * TRACE_TIME_UNIT_NS
+                       || record.system != input[i].system || record.resource != input[i].resource
+                       || record.status != input[i].status || record.priority != input[i].priority
+                       || record.amount != input[i].amount);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    encode_ns = (middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec);
+    decode_ns = (end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec);
+    printf("encode  : %8.1f ns/record, %.0f MB/s of records\n", encode_ns / records,
+           records * sizeof(TraceRecord) / (encode_ns / 1e3));
+    printf("decode  : %8.1f ns/record, %.0f MB/s of records\n", decode_ns / records,
+           records * sizeof(TraceRecord) / (decode_ns / 1e3));
+    printf("size    : %.2f bytes/record, %.1fx smaller, %d records decoded differently\n",
+           (double)size / records, (double)records * sizeof(TraceRecord) / size, mismatches);
+    free(input);
+    free(encoded);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_THREADS;
+    int operations = (argc > 2) ? atoi(argv[2]) : BENCH_DEFAULT_OPERATIONS;
+
+    if (threads <= 0 || operations <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [operations_per_thread]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d threads, %d operations each\n", threads, operations);
+    bench_run("mutex", RESOURCE_SYNC_MUTEX, threads, operations);
+    bench_run("cas", RESOURCE_SYNC_CAS, threads, operations);
+    bench_run("combine", RESOURCE_SYNC_COMBINE, threads, operations);
+
+    printf("Processing time draws (50 ms, spread 10 ms):\n");
+    bench_random("uniform", PROCESSING_UNIFORM, operations * 10);
+    bench_random("normal", PROCESSING_NORMAL, operations * 10);
+    bench_random("exponential", PROCESSING_EXPONENTIAL, operations * 10);
+
+    printf("Trace output (%d records of %zu bytes):\n", operations * 10, sizeof(TraceRecord));
+    bench_output("io_uring", 1, operations * 10);
+    bench_output("pwrite", 0, operations * 10);
+
+    printf("Trace compression (%d records, %d periodic reporters):\n", operations * 10, BENCH_TRACE_SOURCES);
+    bench_codec(operations * 10);
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Per-system event channels: one wait-free single-producer/single-consumer ring per system */
+
+// Each system thread owns the tail of its ring and the manager owns the head, on separate
+// cache lines, so a push writes only lines its own producer uses. The manager finds
+// channels with events in a ready bitmap instead of checking every ring. A producer only
+// writes the bitmap when its channel goes from empty to non-empty; the tail store and head
+// load on one side, and the head store and tail load on the other, are sequentially
+// consistent, so either the producer sees the channel empty and marks it ready or the
+// manager sees the new tail and keeps draining.
+
+static void event_channel_mark_ready(EventChannelSet *set, int index);
+static int event_channel_drain(EventChannel *channel, Event *events, int limit);
+
+/**
+ * Initializes one channel per system, freeing any channels set up before.
+ *
+ * @param[in,out] set    Pointer to the `EventChannelSet`, zeroed or initialized before.
+ * @param[in]     count  Number of channels.
+ */
+void event_channels_init(EventChannelSet *set, int count) {
+    int words = (count + 63) / 64;
+    size_t ready_size = ((words > 0 ? words : 1) * sizeof(atomic_ullong) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+    event_channels_clean(set);
+    set->count = count;
+    set->words = words;
+    set->channels = (EventChannel *)aligned_alloc(CACHE_LINE_SIZE, (count > 0 ? count : 1) * sizeof(EventChannel));
+    set->ready = (atomic_ullong *)aligned_alloc(CACHE_LINE_SIZE, ready_size);
+    set->events = (Event *)malloc(2 * (count > 0 ? count : 1) * EVENT_CHANNEL_CAPACITY * sizeof(Event));
+    if (set->channels == NULL || set->ready == NULL || set->events == NULL) {
+        fprintf(stderr, "Failed to allocate memory for EventChannelSet.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int w = 0; w < words; w++) {
+        atomic_init(&set->ready[w], 0);
+    }
+    for (int i = 0; i < count; i++) {
+        EventChannel *channel = &set->channels[i];
+
+        atomic_init(&channel->tail, 0);
+        channel->cached_head = 0;
+        atomic_init(&channel->head, 0);
+        channel->set = set;
+        channel->index = i;
+    }
+}
+
+/**
+ * Frees the memory used by an `EventChannelSet`, leaving it empty.
+ *
+ * @param[in,out] set  Pointer to the `EventChannelSet`.
+ */
+void event_channels_clean(EventChannelSet *set) {
+    free(set->channels);
+    free(set->ready);
+    free(set->events);
+    memset(set, 0, sizeof(EventChannelSet));
+}
+
+/**
+ * Pushes events onto a channel. Only the channel's own system thread may call this.
+ *
+ * Never waits: if the ring fills up, the events that do not fit are left to the caller.
+ *
+ * @param[in,out] channel  Pointer to the `EventChannel`.
+ * @param[in]     events   The events, oldest first.
+ * @param[in]     count    Number of events.
+ * @return                 Number of events pushed, from the start of `events`.
+ */
+int event_channel_push(EventChannel *channel, const Event *events, int count) {
+    unsigned int tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    unsigned int space = EVENT_CHANNEL_CAPACITY - (tail - channel->cached_head);
+
+    // Only look at the manager's head when the last one seen leaves too little room
+    if (space < (unsigned int)count) {
+        channel->cached_head = atomic_load_explicit(&channel->head, memory_order_acquire);
+        space = EVENT_CHANNEL_CAPACITY - (tail - channel->cached_head);
+    }
+    if ((unsigned int)count > space) {
+        count = (int)space;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        channel->slots[(tail + i) & (EVENT_CHANNEL_CAPACITY - 1)] = events[i];
+    }
+    atomic_store_explicit(&channel->tail, tail + count, memory_order_seq_cst);
+
+    // The channel was empty, so the manager may have stopped looking at it
+    if (atomic_load_explicit(&channel->head, memory_order_seq_cst) == tail) {
+        event_channel_mark_ready(channel->set, channel->index);
+    }
+    return count;
+}
+
+/**
+ * Takes the events waiting in every ready channel, merged highest priority first.
+ *
+ * Events of the same priority keep their order within a channel. Only the manager may
+ * call this.
+ *
+ * @param[in,out] set     Pointer to the `EventChannelSet`.
+ * @param[out]    events  Receives the set's buffer of merged events, valid until the next call.
+ * @return                Number of events.
+ */
+int event_channels_drain(EventChannelSet *set, Event **events) {
+    Event *drained = set->events;
+    Event *merged = set->events + (set->count > 0 ? set->count : 1) * EVENT_CHANNEL_CAPACITY;
+    int counts[PRIORITY_HIGH + 2] = {0};
+    int count = 0;
+
+    for (int w = 0; w < set->words; w++) {
+        unsigned long long ready = atomic_exchange_explicit(&set->ready[w], 0, memory_order_acquire);
+
+        while (ready != 0) {
+            int index = w * 64 + __builtin_ctzll(ready);
+            EventChannel *channel = &set->channels[index];
+            int taken = event_channel_drain(channel, drained + count, EVENT_CHANNEL_CAPACITY);
+
+            // Whatever is left (the producer kept up with us) is picked up next pass
+            if (taken == EVENT_CHANNEL_CAPACITY && atomic_load(&channel->tail) != atomic_load(&channel->head)) {
+                event_channel_mark_ready(set, index);
+            }
+            count += taken;
+            ready &= ready - 1;
+        }
+    }
+
+    // Stable counting sort by priority, highest first
+    for (int i = 0; i < count; i++) {
+        int priority = drained[i].priority;
+        counts[(priority < 0) ? 0 : (priority > PRIORITY_HIGH) ? PRIORITY_HIGH : priority]++;
+    }
+    for (int p = PRIORITY_HIGH, start = 0; p >= 0; p--) {
+        int size = counts[p];
+        counts[p] = start;
+        start += size;
+    }
+    for (int i = 0; i < count; i++) {
+        int priority = drained[i].priority;
+        merged[counts[(priority < 0) ? 0 : (priority > PRIORITY_HIGH) ? PRIORITY_HIGH : priority]++] = drained[i];
+    }
+
+    *events = merged;
+    return count;
+}
+
+/**
+ * Checks whether any channel is marked ready.
+ *
+ * @param[in] set  Pointer to the `EventChannelSet`.
+ * @return         Non-zero if some channel may have events.
+ */
+int event_channels_ready(EventChannelSet *set) {
+    for (int w = 0; w < set->words; w++) {
+        if (atomic_load_explicit(&set->ready[w], memory_order_acquire) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Sets a channel's bit in the ready bitmap.
+ *
+ * @param[in,out] set    Pointer to the `EventChannelSet`.
+ * @param[in]     index  Index of the channel.
+ */
+static void event_channel_mark_ready(EventChannelSet *set, int index) {
+    atomic_fetch_or_explicit(&set->ready[index / 64], 1ull << (index % 64), memory_order_release);
+}
+
+/**
+ * Copies events out of one channel and gives their slots back to its producer.
+ *
+ * @param[in,out] channel  Pointer to the `EventChannel`.
+ * @param[out]    events   Receives the events, oldest first.
+ * @param[in]     limit    Largest number of events to take.
+ * @return                 Number of events taken.
+ */
+static int event_channel_drain(EventChannel *channel, Event *events, int limit) {
+    unsigned int head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    int taken = 0;
+
+    while (taken < limit) {
+        unsigned int tail = atomic_load_explicit(&channel->tail, memory_order_seq_cst);
+
+        if (tail == head) {
+            break;
+        }
+        while (head != tail && taken < limit) {
+            events[taken++] = channel->slots[head & (EVENT_CHANNEL_CAPACITY - 1)];
+            head++;
+        }
+        atomic_store_explicit(&channel->head, head, memory_order_seq_cst);
+    }
+    return taken;
+}
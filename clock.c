@@ -0,0 +1,50 @@
+#include "defs.h"
+
+/* Timespec arithmetic shared by everything that sleeps on or measures CLOCK_MONOTONIC */
+
+/**
+ * Moves a time forward by a number of milliseconds, keeping it normalized.
+ *
+ * @param[in,out] time  The time, with `tv_nsec` below one second.
+ * @param[in]     ms    Milliseconds to add, not negative.
+ */
+void timespec_add_ms(struct timespec *time, long long ms) {
+    time->tv_sec += ms / 1000;
+    time->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (time->tv_nsec >= 1000000000L) {
+        time->tv_sec++;
+        time->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * Nanoseconds from one time to another.
+ *
+ * @param[in] start  The earlier time.
+ * @param[in] end    The later time.
+ * @return           The difference, negative if `end` is before `start`.
+ */
+long long timespec_elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ * Converts a time to nanoseconds, e.g. to publish it in a single atomic.
+ *
+ * @param[in] time  The time.
+ * @return          Nanoseconds since the clock's epoch.
+ */
+long long timespec_to_ns(const struct timespec *time) {
+    return time->tv_sec * 1000000000LL + time->tv_nsec;
+}
+
+/**
+ * Converts nanoseconds back to a normalized time.
+ *
+ * @param[out] time  Receives the time.
+ * @param[in]  ns    Nanoseconds since the clock's epoch, not negative.
+ */
+void timespec_from_ns(struct timespec *time, long long ns) {
+    time->tv_sec = (time_t)(ns / 1000000000LL);
+    time->tv_nsec = (long)(ns % 1000000000LL);
+}
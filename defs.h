@@ -1,4 +1,8 @@
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdio.h>
 
 // Don't worry about these! These are special codes that allow us to do some formatting in the terminal
 // Such as clearing the line before printing or moving the location of the "cursor" that will print.
@@ -23,13 +27,139 @@
 #define STATUS_PRODUCED     10
 
 #define THRESHOLD_RESOURCE_LOW 0.3  // Percentage of resource before it is considered low.
+#define THRESHOLD_HYSTERESIS   0.1  // Fraction of capacity a resource must move back past a threshold to leave it
 #define MANAGER_WAIT_TIME 5         // Milliseconds for the manager to wait between popping the queue
 #define SYSTEM_WAIT_TIME 20         // Milliseconds between loops of the system when production cannot occur
+#define EVENT_SHED_WATERMARK 64     // Queued events at which LOW priority events start being shed, 0 to never shed
+#define EVENT_SHED_SAMPLE    8      // While shedding, one LOW priority event in this many is still queued
+#define EVENT_STAGE_CAPACITY 16     // Events a system thread stages before publishing them as one batch
+#define EVENT_CHANNEL_CAPACITY 64   // Events in each system's channel to the manager, a power of two
 
 #define PRIORITY_HIGH 3
 #define PRIORITY_MED 2
 #define PRIORITY_LOW 1
 
+#define RESOURCE_SYNC_MUTEX    0    // Consume/store under a per-resource mutex
+#define RESOURCE_SYNC_CAS      1    // Consume/store with a compare-and-swap retry loop
+#define RESOURCE_SYNC_COMBINE  2    // Consume/store through a flat-combining publication list
+
+#define RESOURCE_COMBINE_SLOTS 64   // Publication slots per resource when flat-combining
+#define CACHE_LINE_SIZE        64
+
+#define COMBINE_OP_CONSUME 1
+#define COMBINE_OP_STORE   2
+
+#define RESOURCE_LEVEL_NORMAL 0     // Between the thresholds
+#define RESOURCE_LEVEL_LOW    1     // At or below the low threshold
+#define RESOURCE_LEVEL_EMPTY  2     // Nothing left
+#define RESOURCE_LEVEL_FULL   3     // At capacity
+
+#define RESOURCE_ROLE_ANY         -1    // Matches every role in a PolicyRule
+#define RESOURCE_ROLE_NONE         0    // An ordinary resource
+#define RESOURCE_ROLE_LIFE         1    // The crew cannot live without it (Oxygen)
+#define RESOURCE_ROLE_DESTINATION  2    // The trip is over once it is full (Distance)
+
+#define ACTION_NONE       0         // Ignore the event
+#define ACTION_TERMINATE  1         // Stop every system and end the run with the rule's outcome
+#define ACTION_SPEED_UP   2         // Set the producers of the resource to FAST
+#define ACTION_SLOW_DOWN  3         // Set the producers of the resource to SLOW
+#define ACTION_THROTTLE   4         // Set the consumers of the resource to SLOW
+
+#define POLICY_STATUS_COUNT 4       // Statuses STATUS_EMPTY to STATUS_CAPACITY, the columns of a PolicyTable
+
+#define EXCHANGE_EMPTY   0          // No consumer is waiting on the resource
+#define EXCHANGE_WAITING 1          // A consumer is waiting for `exchange_amount` to be handed over
+#define EXCHANGE_FILLED  2          // A producer handed the amount directly to the waiting consumer
+
+#define SAMPLER_DEFAULT_INTERVAL 100    // Milliseconds between samples when recording (10 Hz)
+#define SAMPLER_BLOCK_SAMPLES    64     // Samples per block before it is encoded and flushed to the file
+
+#define OUTCOME_RUNNING     0    // The run has not finished yet
+#define OUTCOME_DESTINATION 1    // Distance reached its capacity
+#define OUTCOME_NO_OXYGEN   2    // Oxygen ran out
+#define OUTCOME_TIME_LIMIT  3    // The run was stopped at its time limit
+#define OUTCOME_FAILED      4    // The run crashed or could not be started
+#define OUTCOME_PRUNED      5    // The run was stopped early because it could not win
+#define OUTCOME_THRESHOLD   6    // Oxygen fell to the lockstep engine's splitting threshold
+#define OUTCOME_STALLED     7    // No system made progress for too long, see stall_check
+
+#define STALL_PERIODS 10         // Periods without progress before a run counts as stalled, 0 to never check
+
+#define WATCHDOG_INTERVAL 50     // Milliseconds between the watchdog's checks of the heartbeats
+#define WATCHDOG_MULTIPLE 5      // Expected periods a heartbeat may stand still before it is reported
+#define WATCHDOG_MIN_MS   100    // Shortest stall ever reported, to ride out scheduling hiccups
+
+#define ACTIVITY_STARTING   0    // What a system or the manager last started doing, for the watchdog
+#define ACTIVITY_CONSUMING  1    // Taking its input
+#define ACTIVITY_WAITING    2    // Waiting for a producer to hand over its input
+#define ACTIVITY_PROCESSING 3    // Sleeping through its processing time
+#define ACTIVITY_STORING    4    // Storing its output
+#define ACTIVITY_RETRYING   5    // Waiting to retry a store that did not fit
+#define ACTIVITY_PUBLISHING 6    // Publishing events (and handling them, without a manager thread)
+#define ACTIVITY_HANDLING   7    // Manager: handling events and applying the policy
+#define ACTIVITY_CHECKING   8    // Manager: monitor, time limit and stall checks
+#define ACTIVITY_SLEEPING   9    // Manager: waiting for the next pass
+
+#define OPTIMIZER_OBSERVE_MS   2000 // Milliseconds a candidate runs before it can be pruned
+#define OPTIMIZER_ELITE        4    // Best candidates later generations are bred from
+#define OPTIMIZER_SLACK        1.5  // Prune once a candidate's projected time exceeds the best by this factor
+
+#define LOCKSTEP_LANES     8         // Variants advanced together by the lockstep engine
+#define LOCKSTEP_MAX_TICKS 3600000   // Default limit of a lockstep run, in virtual milliseconds
+
+#define SCENARIO_STORED        0     // Offsets of a system's values in a ScenarioState
+#define SCENARIO_TIMER         1
+#define SCENARIO_WAIT          2
+#define SCENARIO_STATUS        3
+#define SCENARIO_SYSTEM_FIELDS 4
+
+#define PROCESSING_FIXED       0     // Every processing time is exactly `processing_time`
+#define PROCESSING_UNIFORM     1     // Uniform within +/- `processing_spread` of `processing_time`
+#define PROCESSING_NORMAL      2     // Normal around `processing_time`, standard deviation `processing_spread`
+#define PROCESSING_EXPONENTIAL 3     // Exponential with mean `processing_time`
+
+#define SPLITTING_DEFAULT_LEVELS 4   // Intermediate oxygen thresholds between the start and depletion
+#define SPLITTING_DEFAULT_JITTER 10  // Default +/- percent of random variation in processing times
+
+#define RECORDING_MAGIC       0x4D495352u   // "RSIM" at the start of a recording file
+#define RECORDING_BLOCK_MAGIC 0x4B4C4342u   // "BCLK" at the start of every block
+#define RECORDING_VERSION     1
+#define RECORDING_MAX_BLOCK_SAMPLES 65536  // Largest block a reader accepts, it decodes a block on its stack
+#define VARINT_MAX_BYTES      5             // Longest varint encoding of a 32-bit value
+#define VARINT64_MAX_BYTES    10            // Longest varint encoding of a 64-bit value
+
+#define OUTPUT_PAGE_SIZE    65536    // Bytes per output page; a stream fills one while its other page is written
+#define OUTPUT_MAX_STREAMS  8        // Streams an OutputWriter can have open, their pages are registered up front
+#define OUTPUT_PAGE_COUNT   (2 * OUTPUT_MAX_STREAMS)
+#define OUTPUT_QUEUE_DEPTH  32       // io_uring entries, at least one per page plus the stop NOP
+#define OUTPUT_SUBMIT_BATCH 4        // Queued page writes that are submitted together with one io_uring_enter
+#define OUTPUT_REAP_WAIT_MS 100      // Longest the completion thread waits for completions before checking the writer again
+
+#define TRACE_MAGIC   0x45435254u    // "TRCE" at the start of an event trace
+#define TRACE_VERSION 2              // 2: records compressed by the trace codec
+#define TRACE_TIME_UNIT_NS     1000  // Resolution trace timestamps are kept at
+#define TRACE_DICTIONARY_SIZE  127   // Tuples the trace codec remembers; the slot index fits 7 bits
+#define TRACE_LITERAL          127   // Slot index meaning the tuple follows in full
+#define TRACE_RECORD_MAX_BYTES 32    // Longest compressed record
+
+#define FLIGHT_MAGIC       0x52544C46u      // "FLTR" at the start of a flight recorder dump
+#define FLIGHT_VERSION     1
+#define FLIGHT_RECORDS     4096             // Records kept per thread, a power of two
+#define FLIGHT_MAX_THREADS 64               // Threads that can own a flight recorder ring
+#define FLIGHT_DEFAULT_PATH "flight.rec"
+
+#define FLIGHT_REASON_OXYGEN  1             // The run ended with Oxygen depleted
+#define FLIGHT_REASON_SIGNAL  2             // A fatal signal
+#define FLIGHT_REASON_REQUEST 3             // SIGUSR1
+
+#define FLIGHT_EVENT     1      // Event published: subject resource, a status, b amount, c system, d priority
+#define FLIGHT_HANDLED   2      // Event handled by the manager: same fields as FLIGHT_EVENT
+#define FLIGHT_STATUS    3      // Manager changed a system's status: subject system, a old, b new
+#define FLIGHT_TERMINATE 4      // Run stopped: a outcome
+#define FLIGHT_CONSUME   5      // Consume attempt: subject resource, a amount, b STATUS_*, c amount left
+#define FLIGHT_STORE     6      // Store attempt: subject resource, a amount, b stored, c amount after
+#define FLIGHT_WATCHDOG  7      // Stall reported: subject system, -1 for the manager, a ACTIVITY_*, b ms idle, c limit
+
 
 #include <pthread.h>
 
@@ -39,11 +169,33 @@
 void* system_thread(void* arg);
 void* manager_thread(void* arg);
 
+// One request published to a resource's flat-combining list, padded so each slot owns its cache line
+typedef struct CombineSlot {
+    atomic_int owner;    // non-zero while a thread has claimed this slot
+    atomic_int pending;  // non-zero while the request is waiting for a combiner
+    int op;              // COMBINE_OP_CONSUME or COMBINE_OP_STORE
+    int amount;
+    int result;          // Status for a consume, amount actually stored for a store
+} __attribute__((aligned(CACHE_LINE_SIZE))) CombineSlot;
+
 // Represents the resource amounts for the entire rocket
 typedef struct Resource {
     char *name;      // Dynamically allocated string
-    int amount;
+    atomic_int amount;
     int max_capacity;
+    int sync_mode;          // One of the RESOURCE_SYNC_* strategies
+    pthread_mutex_t lock;   // Guards `amount` in mutex mode, elects the combiner in combining mode
+    CombineSlot *slots;     // Publication list, only allocated in combining mode
+    atomic_int exchange_state;      // EXCHANGE_* state of the producer to consumer hand-off slot
+    int exchange_amount;            // Amount the waiting consumer needs
+    pthread_mutex_t exchange_lock;  // Guards the hand-off slot
+    pthread_cond_t exchange_cond;   // Signalled when the hand-off slot changes state
+    struct EventQueue *event_queue; // Receives an event when the amount crosses a threshold, NULL for none
+    int low_threshold;              // Amount at or below which the resource is low, -1 for THRESHOLD_RESOURCE_LOW
+    int hysteresis;                 // How far back past a threshold the amount must move to leave it, -1 for THRESHOLD_HYSTERESIS
+    atomic_int level;               // Current RESOURCE_LEVEL_*
+    int id;                         // Index in the scenario's ResourceArray
+    int role;                       // One of the RESOURCE_ROLE_* codes, chooses which policy rules apply
 } Resource;
 
 // Represents the amount of a resource consumed/produced for a single system
@@ -52,15 +204,45 @@ typedef struct ResourceAmount {
     int amount;
 } ResourceAmount;
 
+// Counter-based random stream, owned by one thread so it needs no locking
+typedef struct RandomStream {
+    uint64_t key;
+    uint64_t counter;
+} RandomStream;
+
 // A system which consumes resources, waits for `processing_time` milliseconds, then produced the produced resource
 typedef struct System {
     char *name;     // Dynamically allocated string
     ResourceAmount consumed;
     ResourceAmount produced;
-    int amount_stored;
     int processing_time;
-    int status; 
+    int processing_distribution;    // One of the PROCESSING_* distributions
+    int processing_spread;          // Milliseconds, see PROCESSING_*
+    RandomStream random;            // Only used by the system's own thread
+    atomic_int status;              // STANDARD, FAST, SLOW...; written by the manager, read by every thread
+    int id;                         // Index in the manager's system array, -1 until added
     struct EventQueue *event_queue;  // Pointer to event queue shared by all systems and manager
+    struct EventStage *event_stage;  // Events staged by the system's thread, published once per step
+    int on_schedule;                // non-zero while conversions follow each other, so deadlines chain
+    struct timespec run_start;      // When the system's thread started this run
+    struct timespec cpu_start;      // The thread's CPU clock when it started this run
+    long long blocked_base;         // `resource_blocked_ns` of the thread when the run started
+    // Written only by the system's thread, read while it runs by the display, stall detection and watchdog
+    atomic_llong deadline_ns;       // CLOCK_MONOTONIC time the current conversion is due to finish
+    atomic_llong conversions;       // Conversions completed this run
+    atomic_llong nominal_ns;        // Status-adjusted `processing_time` of every conversion completed
+    atomic_llong lag_ns;            // How late the last conversion finished relative to its deadline
+    atomic_llong max_lag_ns;        // Largest `lag_ns` this run
+    atomic_llong step_ns;           // Time from the start of the run to the system's last step
+    atomic_llong cpu_ns;            // CPU time the system's thread used this run
+    atomic_llong sleep_ns;          // Wall time spent sleeping through processing and retry waits
+    atomic_llong starved_ns;        // Wall time spent waiting for a producer to hand over input
+    atomic_llong blocked_ns;        // Wall time spent blocked on resource locks
+    atomic_int amount_stored;       // Produced amount not stored yet
+    atomic_int consume_report;      // Status last reported for consuming, STATUS_OK once it succeeds again
+    atomic_int store_report;        // Status last reported for storing, STATUS_OK once it succeeds again
+    atomic_ulong heartbeat;         // Bumped after every step, watched by the watchdog
+    atomic_int activity;            // ACTIVITY_* the system last started
 } System;
 
 // Used to send notifications to the manager about an issue / state of the system
@@ -70,6 +252,8 @@ typedef struct Event {
     int status;     
     int priority;   // Higher values indicate higher priority
     int amount;     // Amount of the resource in question
+    int from_level; // Threshold events only: the RESOURCE_LEVEL_* the resource left...
+    int to_level;   // ...and the one it entered
 } Event;
 
 // Linked List Node for the Event queue
@@ -82,8 +266,46 @@ typedef struct EventNode {
 typedef struct EventQueue {
     EventNode *head;
     int size;
+    pthread_mutex_t lock;   // Guards the list, since systems push while the manager pops
+    int watermark;          // Backlog at which LOW priority events are shed, 0 to never shed
+    int sample_every;       // While shedding, queue one LOW priority event in this many, 0 for none
+    atomic_int shedding;    // Non-zero while the backlog is over the watermark
+    atomic_uint low_seen;   // LOW priority events offered while shedding, picks the ones sampled
+    atomic_long shed;       // LOW priority events dropped since the last reset
+    int backlog_peak;       // Largest backlog the manager has found, guarded by `lock`
+    void (*on_publish)(void *context);  // Called after events are published, NULL for none
+    void *publish_context;
 } EventQueue;
 
+struct EventChannelSet;
+
+// Wait-free ring carrying one system's events to the manager
+typedef struct EventChannel {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail;     // Next slot to fill, written only by the system thread
+    unsigned int cached_head;                       // Last head the system thread read
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head;     // Next slot to read, written only by the manager
+    struct EventChannelSet *set;
+    int index;                                      // Bit of this channel in the set's ready bitmap
+    Event slots[EVENT_CHANNEL_CAPACITY];
+} EventChannel;
+
+// One channel per system and a bitmap of the channels that may have events
+typedef struct EventChannelSet {
+    EventChannel *channels;
+    int count;
+    atomic_ullong *ready;       // Bit i is set when channel i went from empty to non-empty
+    int words;
+    Event *events;              // Manager's buffers for draining and merging the channels
+} EventChannelSet;
+
+// Events a system thread has not published yet, only touched by that thread
+typedef struct EventStage {
+    EventQueue *queue;
+    EventChannel *channel;      // The system's channel to the manager, NULL to publish to `queue`
+    Event events[EVENT_STAGE_CAPACITY];
+    int count;
+} EventStage;
+
 // A basic dynamic array to store all of the systems in the simulation
 typedef struct SystemArray {
     System **systems;
@@ -98,27 +320,455 @@ typedef struct ResourceArray {
     int capacity;
 } ResourceArray;
 
+// The outcome and key measurements of a single simulation run
+typedef struct RunResult {
+    int outcome;            // One of the OUTCOME_* codes
+    long long elapsed_ms;   // Wall time the run took
+    int min_oxygen;         // Lowest Oxygen amount seen during the run (the oxygen margin)
+    int distance;           // Distance travelled when the run ended
+    long worker_faults;     // Pages a forked worker copied or first touched, zero for in-process runs
+    long worker_rss_kb;     // Peak resident size of a forked worker, including pages still shared
+    long events_shed;       // LOW priority events dropped while the manager was overloaded
+    int event_backlog_peak; // Most events the manager found waiting in one pass
+    long watchdog_alerts;   // Stalled systems or manager passes the watchdog reported
+} RunResult;
+
+// One manager reaction: events with `status` on a resource with `role` trigger `action`
+typedef struct PolicyRule {
+    int role;       // RESOURCE_ROLE_* code, or RESOURCE_ROLE_ANY
+    int status;     // STATUS_* code reported by the event
+    int action;     // ACTION_* code
+    int outcome;    // OUTCOME_* code recorded by ACTION_TERMINATE
+} PolicyRule;
+
+// The action for one (resource, status) pair of a compiled policy
+typedef struct PolicyEntry {
+    int action;
+    int outcome;
+} PolicyEntry;
+
+// The action chosen for one resource in the current manager tick
+typedef struct PolicyDecision {
+    int action;     // ACTION_* code, ACTION_NONE if no event asked for anything
+    int priority;   // Priority of the event that chose it
+} PolicyDecision;
+
+// Policy rules compiled for one scenario, so each event is collected with a single lookup
+typedef struct PolicyTable {
+    int resource_count;
+    PolicyEntry *entries;       // resource_count * POLICY_STATUS_COUNT, indexed by resource id then status
+    PolicyDecision *decisions;  // Per resource, collected from the tick's events
+    int pending_count;          // Resources with a decision this tick
+    int terminate_outcome;      // Outcome of a terminate decided this tick, OUTCOME_RUNNING for none
+} PolicyTable;
+
+struct Manager;
+
+// Called by the manager after every pass; returns an OUTCOME_* code to stop the run with, or OUTCOME_RUNNING
+typedef int (*RunMonitor)(struct Manager *manager, void *context);
+
 // Container structure which contains all of the core data for our simulation
 typedef struct Manager {
-    int simulation_running; // non-zero if the simulation is running, zero if it should be stopped
+    atomic_int simulation_running; // non-zero if the simulation is running, zero if it should be stopped
     SystemArray system_array;
     ResourceArray resource_array;
     EventQueue event_queue;
+    int display;            // non-zero to draw the simulation state and events to the terminal
+    int time_limit_ms;      // Stop the run after this many milliseconds, zero for no limit
+    struct timespec start;  // When the current run started
+    Resource *oxygen;       // Resources the run's outcome is measured on, NULL if the scenario lacks them
+    Resource *distance;
+    RunResult result;       // Outcome of the current run, updated by the manager
+    RunMonitor monitor;     // Optional check run after every manager pass, NULL for none
+    void *monitor_context;
+    const PolicyRule *policy_rules; // Rules compiled into `policy` when a run is prepared
+    int policy_rule_count;
+    PolicyTable policy;
+    int use_channels;       // non-zero to give every system its own channel to the manager
+    EventChannelSet channels;
+    int inline_manager;     // non-zero to handle events in the system threads instead of a manager thread
+    pthread_mutex_t combine_lock;   // Held by whichever thread is running a manager pass inline
+    pthread_mutex_t wait_lock;      // Held by manager_wait while it checks whether to sleep
+    pthread_cond_t stopped;         // Signalled under wait_lock when an inline pass stops the run
+    int stall_periods;              // Periods without progress that end the run, zero to never end it
+    long long stall_period_ms;      // One period: the retry wait plus the slowest system's processing time
+    long long stall_progress;       // Conversions counted when progress was last seen
+    struct timespec stall_since;    // When progress was last seen
+    int watchdog;                   // non-zero to watch the heartbeats of the systems and manager during runs
+    atomic_ulong heartbeat;         // Bumped after every pass of the manager thread
+    atomic_int activity;            // ACTIVITY_* the manager thread last started
+    struct EventTrace *trace;       // Every handled event is appended to it, NULL for none
+    int flight_on_depletion;        // Non-zero to dump the flight recorder when Oxygen runs out
 } Manager;
 
+// Background thread that reports systems and the manager whose heartbeat stops
+typedef struct Watchdog {
+    Manager *manager;
+    int count;                  // Entities watched: every system, then the manager
+    unsigned long *seen;        // Heartbeat last seen, per entity
+    struct timespec *since;     // When it last changed
+    int *flagged;               // Non-zero while a stall is reported and not recovered
+    long alerts;
+    atomic_int running;
+    pthread_t thread;
+} Watchdog;
+
+// Called in each forked worker to turn the loaded scenario into variant `variant`
+typedef void (*VariantSetup)(Manager *manager, int variant, void *context);
+
+// The parts of a scenario that never change while it runs, shared by every instance
+typedef struct ScenarioTemplate {
+    int resource_count;
+    int system_count;
+    int *capacity;                  // Per resource
+    int *initial_amount;            // Per resource
+    int *consumed_index;            // Per system, index of the consumed resource or -1
+    int *consumed_amount;           // Per system
+    int *produced_index;            // Per system, index of the produced resource or -1
+    int *produced_amount;           // Per system
+    int *processing_time;           // Per system, always fixed on the lockstep engine
+    int *initial_stored;            // Per system
+    int *initial_status;            // Per system
+    int oxygen;                     // Index of the Oxygen resource or -1
+    int distance;                   // Index of the Distance resource or -1
+} ScenarioTemplate;
+
+// Mutable state of one instance of a ScenarioTemplate, see scenario_state_size
+typedef struct ScenarioState {
+    int outcome;                    // One of the OUTCOME_* codes
+    int elapsed;                    // Milliseconds the instance has run
+    int min_oxygen;
+    int values[];                   // Amount per resource, then SCENARIO_SYSTEM_FIELDS per system
+} ScenarioState;
+
+// One value per lockstep lane, operated on with SIMD instructions
+typedef int32_t LaneVector __attribute__((vector_size(LOCKSTEP_LANES * sizeof(int32_t))));
+typedef uint32_t LaneBits __attribute__((vector_size(LOCKSTEP_LANES * sizeof(uint32_t))));
+
+// Advances LOCKSTEP_LANES numeric variants of one scenario together in virtual time
+typedef struct LockstepEngine {
+    const ScenarioTemplate *scenario;
+    int resource_count;
+    int system_count;
+    const int *consumed_index;      // Per system, index of the consumed resource or -1
+    const int *produced_index;      // Per system, index of the produced resource or -1
+    int oxygen;                     // Index of the Oxygen resource or -1
+    int distance;                   // Index of the Distance resource or -1
+    LaneVector *amount;             // Per resource
+    LaneVector *capacity;           // Per resource
+    LaneVector *stored;             // Per system
+    LaneVector *timer;              // Per system, virtual milliseconds of processing left
+    LaneVector *wait;               // Per system, virtual milliseconds before the next retry
+    LaneVector *status;             // Per system
+    LaneVector *processing_time;    // Per system
+    LaneVector *consumed_amount;    // Per system
+    LaneVector *produced_amount;    // Per system
+    LaneVector active;              // All bits set in lanes that are still running
+    LaneVector outcome;             // OUTCOME_* code of each lane
+    LaneVector elapsed;             // Virtual milliseconds each lane has run
+    LaneVector min_oxygen;
+    LaneBits random;                // Per lane xorshift state for processing time jitter
+    int jitter;                     // Processing time jitter as a fraction of 65536, 0 for none
+    int oxygen_floor;               // Lanes end with OUTCOME_THRESHOLD once Oxygen is at or below this, -1 for never
+    long long tick;
+} LockstepEngine;
+
+// A single column of the current recording block, stored as zigzag varint deltas
+typedef struct SampleColumn {
+    unsigned char *data;
+    int size;
+    int capacity;
+    int last;           // Previous value in the block, the next value is stored as a delta from it
+    int min;
+    int max;
+    long long sum;
+} SampleColumn;
+
+// Background thread that periodically records every resource amount and system status
+typedef struct Sampler {
+    Manager *manager;
+    struct OutputStream *output;
+    int interval_ms;
+    int block_samples;
+    int sample_count;           // Samples in the current block
+    long long first_time_ms;    // Time of the first sample in the current block
+    long long last_time_ms;     // Time of the last sample in the current block
+    struct timespec start;      // Times are recorded in milliseconds since this point
+    SampleColumn time_column;
+    SampleColumn *columns;      // One per resource followed by one per system
+    int column_count;
+    atomic_int running;
+    pthread_t thread;
+} Sampler;
+
+// Fixed header at the start of a recording, followed by each resource's name and capacity and each system's name
+typedef struct RecordingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t resource_count;
+    uint32_t system_count;
+    uint32_t interval_ms;
+    uint32_t block_samples;
+} RecordingHeader;
+
+// Header of one block of samples, followed by a summary for each column and then the encoded columns
+typedef struct RecordingBlockHeader {
+    uint32_t magic;
+    uint32_t sample_count;
+    int64_t first_time_ms;
+    int64_t last_time_ms;
+    uint32_t payload_size;      // Bytes of encoded column data after the summaries
+    uint32_t column_count;      // Includes the time column
+} RecordingBlockHeader;
+
+// Per-block index of one column, lets readers skip blocks without decoding them
+typedef struct RecordingColumnSummary {
+    int32_t min;
+    int32_t max;
+    int64_t sum;
+    uint32_t offset;            // Offset of the column within the block's payload
+    uint32_t size;              // Encoded size of the column in bytes
+} RecordingColumnSummary;
+
+// One entry of a flight recorder ring, see the FLIGHT_* kinds for what a-d hold
+typedef struct FlightRecord {
+    uint64_t ticks;             // Time stamp counter, see FlightDumpHeader for converting it
+    uint16_t kind;
+    int16_t subject;            // Resource or system id, -1 for none
+    int32_t a;
+    int32_t b;
+    int32_t c;
+    int32_t d;
+    uint32_t reserved;          // Pads the record to 32 bytes
+} FlightRecord;
+
+// The last FLIGHT_RECORDS records of one thread; only that thread writes it
+typedef struct FlightRing {
+    char name[16];
+    atomic_int in_use;          // Non-zero while a thread owns the ring
+    _Alignas(CACHE_LINE_SIZE) atomic_ullong head;   // Records written so far
+    FlightRecord records[FLIGHT_RECORDS];
+} FlightRing;
+
+// Fixed header at the start of a flight recorder dump, followed by the resource names and system names
+// (NUL-terminated, in id order) and then by each ring: a FlightRingHeader and its records, oldest first
+typedef struct FlightDumpHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reason;            // One of the FLIGHT_REASON_* codes
+    uint32_t signal_number;
+    uint32_t ring_count;
+    uint32_t record_size;
+    uint32_t records_per_ring;
+    uint32_t resource_count;
+    uint32_t system_count;
+    uint32_t reserved;
+    uint64_t ticks_start;       // Ticks and CLOCK_MONOTONIC nanoseconds when the recorder was armed...
+    uint64_t ns_start;
+    uint64_t ticks_dump;        // ...and when the dump was taken
+    uint64_t ns_dump;
+} FlightDumpHeader;
+
+// Header of one ring in a flight recorder dump
+typedef struct FlightRingHeader {
+    char name[16];
+    uint64_t head;              // Records the thread ever wrote
+    uint64_t count;             // Records that follow
+} FlightRingHeader;
+
+// One page of an OutputStream, written to the file in one piece
+typedef struct OutputPage {
+    unsigned char *data;        // OUTPUT_PAGE_SIZE bytes, registered with io_uring as fixed buffer `index`
+    size_t size;                // Bytes to write
+    size_t done;                // Bytes written so far, short writes are resumed
+    long long offset;           // Where in the file the page goes
+    struct OutputStream *stream;
+    int index;
+    int busy;                   // Non-zero from being queued until written, guarded by the writer's lock
+    int in_ring;                // Non-zero while the page has an entry on the io_uring, guarded by the writer's lock
+} OutputPage;
+
+// A file written through an OutputWriter, by one thread at a time
+typedef struct OutputStream {
+    struct OutputWriter *writer;    // NULL while the slot is free
+    int fd;
+    OutputPage *pages[2];
+    int current;                // Page being filled
+    size_t fill;                // Bytes in the current page
+    long long offset;           // File offset of the current page
+    long long bytes;            // Bytes handed to the writer so far
+    int error;                  // errno of the first failed write, zero if none
+} OutputStream;
+
+// Shared asynchronous output for traces and recordings, see writer.c
+typedef struct OutputWriter {
+    int use_uring;              // non-zero when writing through io_uring, zero for the pwrite thread (also after io_uring failed)
+    int registered;             // non-zero when the pages are registered as fixed buffers
+    int ring_fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    unsigned sq_entries;
+    void *sqes;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    void *cqes;
+    int queued;                 // Entries in the submission ring not yet submitted
+    int in_ring;                // Pages with an entry on the io_uring whose completion is not reaped yet
+    OutputPage *backlog[OUTPUT_PAGE_COUNT];     // Pages waiting for the pwrite thread
+    unsigned backlog_head;
+    unsigned backlog_tail;
+    int stopping;
+    long long writes;           // Pages queued
+    long long submit_calls;     // io_uring_enter submissions, or pwrite batches
+    long long waits;            // Times a producer had to wait for a page
+    unsigned char *memory;
+    OutputPage pages[OUTPUT_PAGE_COUNT];
+    OutputStream streams[OUTPUT_MAX_STREAMS];
+    pthread_mutex_t lock;       // Guards the submission ring, the backlog and page states
+    pthread_cond_t done;        // Signalled when a page is written
+    pthread_cond_t work;        // Wakes the pwrite thread
+    pthread_t thread;           // Reaps io_uring completions, or runs pwrite
+} OutputWriter;
+
+// Fixed header at the start of an event trace, followed by each resource's name and each system's name
+typedef struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t resource_count;
+    uint32_t system_count;
+    uint32_t time_unit_ns;      // Timestamps are multiples of this
+} TraceHeader;
+
+// One event handled by the manager
+typedef struct TraceRecord {
+    int64_t time_ns;            // Since the trace was opened
+    int16_t system;             // System id, -1 for threshold events
+    int16_t resource;           // Resource id
+    int16_t status;
+    int16_t priority;
+    int32_t amount;
+    int32_t reserved;
+} TraceRecord;
+
+// A (system, resource, status, priority) tuple the trace codec has seen, with its last amount
+typedef struct TraceCodecEntry {
+    int16_t system;
+    int16_t resource;
+    int16_t status;
+    int16_t priority;
+    int32_t amount;
+    int32_t used;               // Zero until a tuple is stored in the slot
+    int64_t last_time;          // When the tuple last occurred, in time units
+    int64_t interval;           // Time between its last two occurrences, its next one is predicted as far on
+} TraceCodecEntry;
+
+// State shared by the trace encoder and decoder, both sides update it the same way
+typedef struct TraceCodec {
+    int64_t last_time;          // Previous record's time, in time units
+    int64_t time_unit_ns;
+    TraceCodecEntry entries[TRACE_DICTIONARY_SIZE];
+} TraceCodec;
+
+// Writes every event the manager handles to a file
+typedef struct EventTrace {
+    OutputStream *stream;
+    struct timespec start;
+    TraceCodec codec;
+    long long events;
+    long long bytes;            // Compressed size of the records written
+} EventTrace;
+
 // Manager functions
 void manager_init(Manager *manager);
 void manager_clean(Manager *manager);
 void manager_run(Manager *manager);
+void manager_terminate(Manager *manager, int outcome);
+void manager_check(Manager *manager);
+void manager_combine(void *context);
+void manager_wait(Manager *manager);
+int manager_pending(Manager *manager);
+
+// Stall detection functions
+void stall_reset(Manager *manager);
+void stall_check(Manager *manager);
+
+// Watchdog functions
+void watchdog_start(Watchdog *watchdog, Manager *manager);
+long watchdog_stop(Watchdog *watchdog);
+
+// Policy functions
+const PolicyRule *policy_default(int *count);
+void policy_compile(PolicyTable *table, Manager *manager, const PolicyRule *rules, int count);
+void policy_clean(PolicyTable *table);
+int policy_collect(Manager *manager, const Event *event);
+void policy_apply(Manager *manager);
+
+// Runner functions
+void simulation_prepare(Manager *manager);
+void simulation_run(Manager *manager, RunResult *result);
+void simulation_resume(Manager *manager);
+void simulation_seed(Manager *manager, uint64_t seed);
+void runner_run_variants(Manager *manager, int variant_count, int jobs, VariantSetup setup, void *context, RunResult *results);
+const char *outcome_name(int outcome);
+double run_time_to_destination(const RunResult *result, long long offset_ms, int destination);
+
+// Sensitivity analysis functions
+void sensitivity_run(Manager *manager, double epsilon, int warmup_ms, int jobs, int lockstep);
+
+// Scenario template functions
+void scenario_template_init(ScenarioTemplate *scenario, Manager *manager);
+void scenario_template_clean(ScenarioTemplate *scenario);
+size_t scenario_state_size(const ScenarioTemplate *scenario);
+ScenarioState *scenario_state_array(const ScenarioTemplate *scenario, int count);
+ScenarioState *scenario_state_at(const ScenarioTemplate *scenario, ScenarioState *states, int index);
+void scenario_state_init(const ScenarioTemplate *scenario, ScenarioState *state);
+
+// Lockstep engine functions
+void lockstep_init(LockstepEngine *engine, const ScenarioTemplate *scenario, int lanes);
+void lockstep_clean(LockstepEngine *engine);
+void lockstep_load_lane(LockstepEngine *engine, int lane, const Manager *manager);
+void lockstep_run(LockstepEngine *engine, long long max_ticks);
+void lockstep_result(const LockstepEngine *engine, int lane, RunResult *result);
+void lockstep_set_jitter(LockstepEngine *engine, int percent);
+void lockstep_seed_lane(LockstepEngine *engine, int lane, uint32_t seed);
+void lockstep_save_lane(const LockstepEngine *engine, int lane, ScenarioState *state);
+void lockstep_restore_lane(LockstepEngine *engine, int lane, const ScenarioState *state);
+
+// Rare-event splitting functions
+void splitting_run(Manager *manager, int particles, int levels, int jitter_percent, unsigned int seed);
+
+// Batch runner functions
+void batch_run(Manager *manager, int variant_count, double spread, int jobs, unsigned int seed);
+
+// Configuration optimizer functions
+void optimizer_run(Manager *manager, int budget, int jobs, unsigned int seed);
 
 // System functions
 void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue);
 void system_destroy(System *system);
 void system_run(System *system);
+void system_set_processing(System *system, int distribution, int spread);
+void system_reset_schedule(System *system);
+double system_rate(const System *system);
 
 // Resource functions
 void resource_create(Resource **resource, const char *name, int amount, int max_capacity);
 void resource_destroy(Resource *resource);
+void resource_set_sync_mode(Resource *resource, int sync_mode);
+int resource_consume(Resource *resource, int amount);
+int resource_consume_wait(Resource *resource, int amount, int timeout_ms);
+int resource_store(Resource *resource, int amount);
+void resource_set_thresholds(Resource *resource, int low_threshold, int hysteresis);
+void resource_set_event_queue(Resource *resource, struct EventQueue *event_queue);
+void resource_set_role(Resource *resource, int role);
+long long resource_blocked_ns(void);
+const char *resource_level_name(int level);
 
 // ResourceAmount functions
 void resource_amount_init(ResourceAmount *resource_amount, Resource *resource, int amount);
@@ -129,8 +779,79 @@ void event_init(Event *event, System *system, Resource *resource, int status, in
 // EventQueue functions
 void event_queue_init(EventQueue *queue);
 void event_queue_clean(EventQueue *queue);
-void event_queue_push(EventQueue *queue, const Event *event); 
+int event_queue_push(EventQueue *queue, const Event *event);
 int event_queue_pop(EventQueue *queue, Event* event);
+void event_queue_set_shedding(EventQueue *queue, int watermark, int sample_every);
+int event_queue_measure(EventQueue *queue);
+int event_queue_size(EventQueue *queue);
+
+// EventStage functions
+void event_stage_init(EventStage *stage, EventQueue *queue);
+int event_stage_push(EventStage *stage, const Event *event);
+void event_stage_flush(EventStage *stage);
+void event_stage_bind(EventStage *stage);
+int event_publish(EventQueue *queue, const Event *event);
+
+// EventChannel functions
+void event_channels_init(EventChannelSet *set, int count);
+void event_channels_clean(EventChannelSet *set);
+int event_channel_push(EventChannel *channel, const Event *events, int count);
+int event_channels_drain(EventChannelSet *set, Event **events);
+int event_channels_ready(EventChannelSet *set);
+
+// Output writer functions
+void output_init(OutputWriter *writer, int use_uring);
+void output_clean(OutputWriter *writer);
+const char *output_backend_name(const OutputWriter *writer);
+OutputStream *output_open(OutputWriter *writer, const char *path);
+void output_write(OutputStream *stream, const void *data, size_t size);
+void output_flush(OutputStream *stream);
+int output_close(OutputStream *stream);
+
+// Event trace functions
+int trace_open(EventTrace *trace, OutputWriter *writer, const Manager *manager, const char *path);
+void trace_event(EventTrace *trace, const Event *event);
+int trace_close(EventTrace *trace);
+
+// Sampler functions
+void sampler_start(Sampler *sampler, Manager *manager, OutputWriter *writer, const char *path, int interval_ms);
+void sampler_stop(Sampler *sampler);
+
+// Flight recorder functions
+void flight_recorder_init(const char *path, const Manager *manager);
+void flight_recorder_dump(int reason, int signal_number);
+void flight_thread_start(const char *name);
+void flight_thread_stop(void);
+void flight_record(int kind, int subject, int a, int b, int c, int d);
+void flight_record_event(int kind, const Event *event);
+
+// Random stream functions
+void random_stream_init(RandomStream *stream, uint64_t seed, uint64_t stream_id);
+uint64_t random_next(RandomStream *stream);
+double random_uniform(RandomStream *stream);
+double random_normal(RandomStream *stream);
+double random_exponential(RandomStream *stream);
+int random_processing_time(RandomStream *stream, int distribution, int base, int spread);
+int random_distribution_from_name(const char *name);
+
+// Clock functions
+void timespec_add_ms(struct timespec *time, long long ms);
+long long timespec_elapsed_ns(const struct timespec *start, const struct timespec *end);
+long long timespec_to_ns(const struct timespec *time);
+void timespec_from_ns(struct timespec *time, long long ns);
+
+// Encoding functions
+int varint_encode(uint32_t value, unsigned char *out);
+int varint_decode(const unsigned char *in, const unsigned char *end, uint32_t *value);
+uint32_t zigzag_encode(int32_t value);
+int32_t zigzag_decode(uint32_t value);
+uint64_t zigzag64_encode(int64_t value);
+int64_t zigzag64_decode(uint64_t value);
+int varint64_encode(uint64_t value, unsigned char *out);
+int varint64_decode(const unsigned char *in, const unsigned char *end, uint64_t *value);
+void trace_codec_init(TraceCodec *codec, uint32_t time_unit_ns);
+int trace_encode(TraceCodec *codec, const TraceRecord *record, unsigned char *out);
+int trace_decode(TraceCodec *codec, const unsigned char *in, const unsigned char *end, TraceRecord *record);
 
 // Dynamic array functions for systems and resources
 void system_array_init(SystemArray *array);
@@ -0,0 +1,320 @@
+#include "defs.h"
+
+/* Varint and zigzag encoding used by recordings, and the codec that compresses traces */
+
+static int trace_codec_slot(int system, int resource, int status, int priority);
+
+/**
+ * Encodes an unsigned value as a little-endian base-128 varint.
+ *
+ * Small values take a single byte, the largest 32-bit value takes `VARINT_MAX_BYTES`.
+ *
+ * @param[in]  value  The value to encode.
+ * @param[out] out    Buffer with room for at least `VARINT_MAX_BYTES` bytes.
+ * @return            Number of bytes written.
+ */
+int varint_encode(uint32_t value, unsigned char *out) {
+    int length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+
+    return length;
+}
+
+/**
+ * Decodes a varint written by `varint_encode`.
+ *
+ * @param[in]  in     Start of the encoded value.
+ * @param[in]  end    End of the readable buffer.
+ * @param[out] value  The decoded value.
+ * @return            Number of bytes read, or zero if the buffer ended mid-value.
+ */
+int varint_decode(const unsigned char *in, const unsigned char *end, uint32_t *value) {
+    uint32_t result = 0;
+    int shift = 0, length = 0;
+
+    while (in + length < end && length < VARINT_MAX_BYTES) {
+        unsigned char byte = in[length++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return length;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/**
+ * Maps a signed value to an unsigned one so small negative deltas stay small.
+ *
+ * @param[in] value  The signed value.
+ * @return           0, -1, 1, -2, 2... mapped to 0, 1, 2, 3, 4...
+ */
+uint32_t zigzag_encode(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/**
+ * 64-bit version of `zigzag_encode`.
+ *
+ * @param[in] value  The signed value.
+ * @return           The value mapped as by `zigzag_encode`.
+ */
+uint64_t zigzag64_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * Reverses `zigzag_encode`.
+ *
+ * @param[in] value  The zigzag encoded value.
+ * @return           The original signed value.
+ */
+int32_t zigzag_decode(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/**
+ * Reverses `zigzag64_encode`.
+ *
+ * @param[in] value  The mapped value.
+ * @return           The original signed value.
+ */
+int64_t zigzag64_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/**
+ * Encodes a 64-bit unsigned value as a little-endian base-128 varint.
+ *
+ * @param[in]  value  The value to encode.
+ * @param[out] out    Buffer with room for at least `VARINT64_MAX_BYTES` bytes.
+ * @return            Number of bytes written.
+ */
+int varint64_encode(uint64_t value, unsigned char *out) {
+    int length = 0;
+
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+
+    return length;
+}
+
+/**
+ * Decodes a varint written by `varint64_encode`.
+ *
+ * @param[in]  in     Start of the encoded value.
+ * @param[in]  end    End of the readable buffer.
+ * @param[out] value  The decoded value.
+ * @return            Number of bytes read, or zero if the buffer ended mid-value.
+ */
+int varint64_decode(const unsigned char *in, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0, length = 0;
+
+    while (in + length < end && length < VARINT64_MAX_BYTES) {
+        unsigned char byte = in[length++];
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return length;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/* Trace compression: each record is coded against the records before it */
+
+// A record starts with one byte. Its low 7 bits name a dictionary slot holding a (system,
+// resource, status, priority) tuple, or TRACE_LITERAL when the tuple follows as varints and
+// replaces the slot it hashes to. The high bit is set when the amount differs from the
+// last amount seen with that slot. The time follows as a zigzag varint in the trace's time
+// unit: most tuples recur at a steady rate (a system reporting LOW every retry period), so
+// it is coded against the slot's last time plus its last interval, which leaves only the
+// jitter. A new tuple's time is coded against the previous record's. The amount's change
+// follows, as a zigzag varint, if the high bit is set. A repeated tuple with an unchanged
+// amount costs the header byte plus a byte or two of jitter. Encoder and decoder update
+// the dictionary the same way, so it is never stored.
+
+/**
+ * Resets a `TraceCodec` to the state both sides start a trace with.
+ *
+ * @param[out] codec         Pointer to the `TraceCodec`.
+ * @param[in]  time_unit_ns  Resolution the trace keeps timestamps at, in nanoseconds.
+ */
+void trace_codec_init(TraceCodec *codec, uint32_t time_unit_ns) {
+    codec->time_unit_ns = (time_unit_ns > 0) ? time_unit_ns : 1;
+    codec->last_time = 0;
+    for (int i = 0; i < TRACE_DICTIONARY_SIZE; i++) {
+        codec->entries[i].system = -1;
+        codec->entries[i].resource = -1;
+        codec->entries[i].status = -1;
+        codec->entries[i].priority = -1;
+        codec->entries[i].amount = 0;
+        codec->entries[i].used = 0;
+        codec->entries[i].last_time = 0;
+        codec->entries[i].interval = 0;
+    }
+}
+
+/**
+ * Compresses one record.
+ *
+ * Records must be encoded in time order; the timestamp is rounded down to the codec's unit,
+ * and one earlier than the previous record's is moved up to it.
+ *
+ * @param[in,out] codec   Pointer to the encoder's `TraceCodec`.
+ * @param[in]     record  Pointer to the `TraceRecord`.
+ * @param[out]    out     Buffer with room for at least `TRACE_RECORD_MAX_BYTES` bytes.
+ * @return                Number of bytes written.
+ */
+int trace_encode(TraceCodec *codec, const TraceRecord *record, unsigned char *out) {
+    int slot = trace_codec_slot(record->system, record->resource, record->status, record->priority);
+    TraceCodecEntry *entry = &codec->entries[slot];
+    int64_t time = record->time_ns / codec->time_unit_ns;
+    int length = 1;
+
+    if (time < codec->last_time) {
+        time = codec->last_time;
+    }
+
+    if (entry->used && entry->system == record->system && entry->resource == record->resource &&
+        entry->status == record->status && entry->priority == record->priority) {
+        out[0] = (unsigned char)slot;
+    } else {
+        out[0] = TRACE_LITERAL;
+        length += varint_encode(zigzag_encode(record->system), out + length);
+        length += varint_encode(zigzag_encode(record->resource), out + length);
+        length += varint_encode(zigzag_encode(record->status), out + length);
+        length += varint_encode(zigzag_encode(record->priority), out + length);
+        entry->system = record->system;
+        entry->resource = record->resource;
+        entry->status = record->status;
+        entry->priority = record->priority;
+        entry->amount = 0;
+        entry->used = 1;
+        entry->last_time = codec->last_time;
+        entry->interval = 0;
+    }
+
+    length += varint64_encode(zigzag64_encode(time - (entry->last_time + entry->interval)), out + length);
+    entry->interval = time - entry->last_time;
+    entry->last_time = time;
+    codec->last_time = time;
+
+    if (record->amount != entry->amount) {
+        out[0] |= 0x80;
+        length += varint_encode(zigzag_encode(record->amount - entry->amount), out + length);
+        entry->amount = record->amount;
+    }
+    return length;
+}
+
+/**
+ * Decompresses one record written by `trace_encode`.
+ *
+ * Works on a stream read in pieces: if the buffer ends mid-record nothing is consumed and
+ * the codec is left as it was, so the call can be repeated once more bytes are read.
+ *
+ * @param[in,out] codec   Pointer to the decoder's `TraceCodec`.
+ * @param[in]     in      Start of the encoded record.
+ * @param[in]     end     End of the readable buffer.
+ * @param[out]    record  Receives the record, with its time a multiple of the codec's unit.
+ * @return                Number of bytes read, zero if the buffer ended mid-record, -1 if the data is corrupt.
+ */
+int trace_decode(TraceCodec *codec, const unsigned char *in, const unsigned char *end, TraceRecord *record) {
+    TraceCodecEntry literal;
+    const TraceCodecEntry *entry;
+    uint32_t fields[4], change = 0;
+    uint64_t jitter;
+    int64_t time;
+    int slot, length = 1, read;
+
+    if (in >= end) {
+        return 0;
+    }
+
+    slot = in[0] & 0x7F;
+    if (slot == TRACE_LITERAL) {
+        for (int i = 0; i < 4; i++) {
+            read = varint_decode(in + length, end, &fields[i]);
+            if (read == 0) {
+                return (end - (in + length) >= VARINT_MAX_BYTES) ? -1 : 0;
+            }
+            length += read;
+        }
+        literal.system = (int16_t)zigzag_decode(fields[0]);
+        literal.resource = (int16_t)zigzag_decode(fields[1]);
+        literal.status = (int16_t)zigzag_decode(fields[2]);
+        literal.priority = (int16_t)zigzag_decode(fields[3]);
+        literal.amount = 0;
+        literal.used = 1;
+        literal.last_time = codec->last_time;
+        literal.interval = 0;
+        slot = trace_codec_slot(literal.system, literal.resource, literal.status, literal.priority);
+        entry = &literal;
+    } else if (codec->entries[slot].used) {
+        entry = &codec->entries[slot];
+    } else {
+        return -1;
+    }
+
+    read = varint64_decode(in + length, end, &jitter);
+    if (read == 0) {
+        return (end - (in + length) >= VARINT64_MAX_BYTES) ? -1 : 0;
+    }
+    length += read;
+    if (in[0] & 0x80) {
+        read = varint_decode(in + length, end, &change);
+        if (read == 0) {
+            return (end - (in + length) >= VARINT_MAX_BYTES) ? -1 : 0;
+        }
+        length += read;
+    }
+
+    // The whole record is here, so the codec can move on
+    time = entry->last_time + entry->interval + zigzag64_decode(jitter);
+    codec->entries[slot] = *entry;
+    codec->entries[slot].amount += zigzag_decode(change);
+    codec->entries[slot].interval = time - entry->last_time;
+    codec->entries[slot].last_time = time;
+    codec->last_time = time;
+
+    record->time_ns = time * codec->time_unit_ns;
+    record->system = codec->entries[slot].system;
+    record->resource = codec->entries[slot].resource;
+    record->status = codec->entries[slot].status;
+    record->priority = codec->entries[slot].priority;
+    record->amount = codec->entries[slot].amount;
+    record->reserved = 0;
+    return length;
+}
+
+/**
+ * Picks the dictionary slot of a tuple.
+ *
+ * @param[in] system    System id.
+ * @param[in] resource  Resource id.
+ * @param[in] status    Event status.
+ * @param[in] priority  Event priority.
+ * @return              The slot, below `TRACE_DICTIONARY_SIZE`.
+ */
+static int trace_codec_slot(int system, int resource, int status, int priority) {
+    uint32_t hash = (uint32_t)system * 0x9E3779B1u;
+
+    hash = (hash ^ (uint32_t)resource) * 0x85EBCA77u;
+    hash = (hash ^ (uint32_t)status) * 0xC2B2AE3Du;
+    hash = (hash ^ (uint32_t)priority) * 0x27D4EB2Fu;
+    return (int)((hash >> 16) % TRACE_DICTIONARY_SIZE);
+}
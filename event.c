@@ -2,6 +2,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+static int event_queue_admit(EventQueue *queue, const Event *event);
+static EventNode *event_node_create(const Event *event);
+static void event_queue_insert(EventQueue *queue, EventNode *nodes, int count);
+static void event_queue_insert_stage(EventQueue *queue, const Event *events, int count);
+
+// The system thread currently staging its events, see `event_stage_bind`
+static _Thread_local EventStage *event_stage_current = NULL;
+
 /* Event functions */
 
 /**
@@ -22,6 +30,8 @@ void event_init(Event *event, System *system, Resource *resource, int status, in
     event->status = status;
     event->priority = priority;
     event->amount = amount;
+    event->from_level = RESOURCE_LEVEL_NORMAL;
+    event->to_level = RESOURCE_LEVEL_NORMAL;
 }
 
 /* EventQueue functions */
@@ -36,6 +46,15 @@ void event_init(Event *event, System *system, Resource *resource, int status, in
 void event_queue_init(EventQueue *queue) {
     queue->head = NULL;
     queue->size = 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->watermark = EVENT_SHED_WATERMARK;
+    queue->sample_every = EVENT_SHED_SAMPLE;
+    atomic_init(&queue->shedding, 0);
+    atomic_init(&queue->low_seen, 0);
+    atomic_init(&queue->shed, 0);
+    queue->backlog_peak = 0;
+    queue->on_publish = NULL;
+    queue->publish_context = NULL;
 }
 
 /**
@@ -54,6 +73,7 @@ void event_queue_clean(EventQueue *queue) {
     }
     queue->head = NULL;
     queue->size = 0;
+    pthread_mutex_destroy(&queue->lock);
 }
 
 /**
@@ -61,38 +81,31 @@ void event_queue_clean(EventQueue *queue) {
  *
  * Adds the event to the queue, maintaining priority order (highest first).
  * Ensures that older events of the same priority come before newer ones.
+ * While the manager is overloaded (see `event_queue_measure`) only one LOW priority
+ * event in `sample_every` is queued and the rest are counted as shed; MED and HIGH
+ * priority events are always queued. So are threshold events, whatever their priority:
+ * a resource reports each crossing only once, so a shed one would never be offered again.
  *
  * @param[in,out] queue  Pointer to the `EventQueue`.
  * @param[in]     event  Pointer to the `Event` to push onto the queue.
+ * @return               1 if the event was queued, 0 if it was shed.
  */
-void event_queue_push(EventQueue *queue, const Event *event) {
-    // Create a new EventNode
-    EventNode *new_node = (EventNode *)malloc(sizeof(EventNode));
-    if (new_node == NULL) {
-        fprintf(stderr, "Memory allocation failed for EventNode.\n");
-        exit(EXIT_FAILURE);
+int event_queue_push(EventQueue *queue, const Event *event) {
+    EventNode *new_node;
+
+    // Shed LOW priority events before paying for a node or the lock
+    if (!event_queue_admit(queue, event)) {
+        return 0;
     }
-    // Copy the event data into the new node
-    new_node->event = *event;
-    new_node->next = NULL;
-
-    // Special case: Empty queue or new node has higher priority than head
-    if (queue->head == NULL || event->priority > queue->head->event.priority) {
-        new_node->next = queue->head;
-        queue->head = new_node;
-    } else {
-        // Traverse the queue to find the correct insertion point
-        EventNode *current = queue->head;
-        EventNode *previous = NULL;
-        while (current != NULL && current->event.priority >= event->priority) {
-            previous = current;
-            current = current->next;
-        }
-        // Insert the new node
-        previous->next = new_node;
-        new_node->next = current;
+
+    // Create a new EventNode
+    new_node = event_node_create(event);
+    event_queue_insert(queue, new_node, 1);
+
+    if (queue->on_publish != NULL) {
+        queue->on_publish(queue->publish_context);
     }
-    queue->size++;
+    return 1;
 }
 
 /**
@@ -105,15 +118,274 @@ void event_queue_push(EventQueue *queue, const Event *event) {
  * @return               Non-zero if an event was successfully popped; zero otherwise.
  */
 int event_queue_pop(EventQueue *queue, Event *event) {
+    pthread_mutex_lock(&queue->lock);
     if (queue->head == NULL) {
         // Queue is empty
+        pthread_mutex_unlock(&queue->lock);
         return 0;
     }
     // Remove the head node
     EventNode *temp = queue->head;
     *event = temp->event; // Copy the event data
     queue->head = temp->next;
-    free(temp);
     queue->size--;
+    pthread_mutex_unlock(&queue->lock);
+    free(temp);
     return 1; // Indicate that an event was successfully popped
 }
+
+/**
+ * Sets when an `EventQueue` sheds LOW priority events.
+ *
+ * @param[in,out] queue         Pointer to the `EventQueue`.
+ * @param[in]     watermark     Backlog at which shedding starts, 0 to never shed.
+ * @param[in]     sample_every  While shedding, one LOW priority event in this many is still queued, 0 for none.
+ */
+void event_queue_set_shedding(EventQueue *queue, int watermark, int sample_every) {
+    queue->watermark = (watermark > 0) ? watermark : 0;
+    queue->sample_every = (sample_every > 0) ? sample_every : 0;
+    if (queue->watermark == 0) {
+        atomic_store(&queue->shedding, 0);
+    }
+}
+
+/**
+ * Measures the backlog the manager is about to drain and updates shedding.
+ *
+ * Called by the manager at the start of every pass. Shedding stops once the backlog
+ * found is back at half the watermark or less, so it does not flap at the watermark.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @return               Number of events waiting.
+ */
+int event_queue_measure(EventQueue *queue) {
+    int backlog;
+
+    pthread_mutex_lock(&queue->lock);
+    backlog = queue->size;
+    if (backlog > queue->backlog_peak) {
+        queue->backlog_peak = backlog;
+    }
+    if (queue->watermark == 0 || backlog <= queue->watermark / 2) {
+        atomic_store_explicit(&queue->shedding, 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return backlog;
+}
+
+/**
+ * Number of events waiting in an `EventQueue`.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @return               The number of events.
+ */
+int event_queue_size(EventQueue *queue) {
+    int size;
+
+    pthread_mutex_lock(&queue->lock);
+    size = queue->size;
+    pthread_mutex_unlock(&queue->lock);
+    return size;
+}
+
+/**
+ * Initializes an `EventStage` that publishes to `queue`.
+ *
+ * @param[out] stage  Pointer to the `EventStage` to initialize.
+ * @param[in]  queue  Pointer to the `EventQueue` the staged events go to.
+ */
+void event_stage_init(EventStage *stage, EventQueue *queue) {
+    stage->queue = queue;
+    stage->channel = NULL;
+    stage->count = 0;
+}
+
+/**
+ * Stages an `Event`, to be published with the rest of the stage's events.
+ *
+ * Shedding is decided here, so the caller knows straight away whether the event will
+ * reach the manager. The stage is published at once when it fills up or when the event
+ * is HIGH priority, so urgent events never wait for the end of the step.
+ *
+ * @param[in,out] stage  Pointer to the `EventStage`.
+ * @param[in]     event  Pointer to the `Event`.
+ * @return               1 if the event will be queued, 0 if it was shed.
+ */
+int event_stage_push(EventStage *stage, const Event *event) {
+    if (stage->queue == NULL || !event_queue_admit(stage->queue, event)) {
+        return 0;
+    }
+
+    stage->events[stage->count++] = *event;
+    if (stage->count == EVENT_STAGE_CAPACITY || event->priority >= PRIORITY_HIGH) {
+        event_stage_flush(stage);
+    }
+    return 1;
+}
+
+/**
+ * Publishes every staged event to the queue under a single lock acquisition.
+ *
+ * Nodes are allocated and sorted by priority before the lock is taken, then merged into
+ * the queue in one walk, keeping the queue's order: highest priority first, oldest first
+ * within a priority. A stage with a channel pushes onto the channel instead, and only
+ * events that do not fit in it go to the queue. The queue's `on_publish` hook runs once
+ * for the whole batch.
+ *
+ * @param[in,out] stage  Pointer to the `EventStage`.
+ */
+void event_stage_flush(EventStage *stage) {
+    int count = stage->count;
+    int first = 0;
+
+    if (count == 0) {
+        return;
+    }
+
+    if (stage->channel != NULL) {
+        first = event_channel_push(stage->channel, stage->events, count);
+    }
+    stage->count = 0;
+    if (first < count) {
+        event_queue_insert_stage(stage->queue, stage->events + first, count - first);
+    }
+
+    if (stage->queue->on_publish != NULL) {
+        stage->queue->on_publish(stage->queue->publish_context);
+    }
+}
+
+/**
+ * Sorts staged events by priority into a chain of nodes and merges it into the queue.
+ *
+ * @param[in,out] queue   Pointer to the `EventQueue`.
+ * @param[in]     events  The staged events, oldest first.
+ * @param[in]     count   Number of events, at most `EVENT_STAGE_CAPACITY`.
+ */
+static void event_queue_insert_stage(EventQueue *queue, const Event *events, int count) {
+    EventNode *nodes[EVENT_STAGE_CAPACITY];
+
+    // Stable insertion sort, highest priority first
+    for (int i = 0; i < count; i++) {
+        EventNode *node = event_node_create(&events[i]);
+        int j = i;
+
+        while (j > 0 && nodes[j - 1]->event.priority < node->event.priority) {
+            nodes[j] = nodes[j - 1];
+            j--;
+        }
+        nodes[j] = node;
+    }
+    for (int i = 0; i + 1 < count; i++) {
+        nodes[i]->next = nodes[i + 1];
+    }
+
+    event_queue_insert(queue, nodes[0], count);
+}
+
+/**
+ * Makes `stage` the stage of the calling thread, see `event_publish`.
+ *
+ * @param[in] stage  Pointer to the thread's `EventStage`, or NULL to publish directly again.
+ */
+void event_stage_bind(EventStage *stage) {
+    event_stage_current = stage;
+}
+
+/**
+ * Publishes an `Event` through the calling thread's stage if it has one for `queue`,
+ * otherwise pushes it straight onto the queue.
+ *
+ * Lets code shared by every thread, such as resource threshold tracking, batch its events
+ * with the system thread that caused them.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     event  Pointer to the `Event`.
+ * @return               1 if the event was (or will be) queued, 0 if it was shed.
+ */
+int event_publish(EventQueue *queue, const Event *event) {
+    EventStage *stage = event_stage_current;
+
+    if (stage != NULL && stage->queue == queue) {
+        return event_stage_push(stage, event);
+    }
+    return event_queue_push(queue, event);
+}
+
+/**
+ * Decides whether an event gets queued or shed, see `event_queue_push`.
+ *
+ * Admitted events are noted in the calling thread's flight recorder ring.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     event  Pointer to the `Event`.
+ * @return               1 to queue the event, 0 if it was shed.
+ */
+static int event_queue_admit(EventQueue *queue, const Event *event) {
+    if (event->priority <= PRIORITY_LOW && event->system != NULL && atomic_load_explicit(&queue->shedding, memory_order_relaxed)) {
+        unsigned int seen = atomic_fetch_add_explicit(&queue->low_seen, 1, memory_order_relaxed);
+        if (queue->sample_every == 0 || seen % queue->sample_every != 0) {
+            atomic_fetch_add_explicit(&queue->shed, 1, memory_order_relaxed);
+            return 0;
+        }
+    }
+    flight_record_event(FLIGHT_EVENT, event);
+    return 1;
+}
+
+/**
+ * Allocates a queue node holding a copy of an event.
+ *
+ * @param[in] event  Pointer to the `Event`.
+ * @return           The node, with no successor.
+ */
+static EventNode *event_node_create(const Event *event) {
+    EventNode *node = (EventNode *)malloc(sizeof(EventNode));
+
+    if (node == NULL) {
+        fprintf(stderr, "Memory allocation failed for EventNode.\n");
+        exit(EXIT_FAILURE);
+    }
+    node->event = *event;
+    node->next = NULL;
+    return node;
+}
+
+/**
+ * Merges a chain of nodes, already sorted highest priority first, into the queue.
+ *
+ * Each node goes after every queued node of the same or higher priority. The chain is
+ * sorted, so the insertion point only moves forward and the queue is walked once.
+ *
+ * @param[in,out] queue  Pointer to the `EventQueue`.
+ * @param[in]     nodes  First node of the chain.
+ * @param[in]     count  Number of nodes in the chain.
+ */
+static void event_queue_insert(EventQueue *queue, EventNode *nodes, int count) {
+    EventNode **link;
+
+    pthread_mutex_lock(&queue->lock);
+
+    link = &queue->head;
+    while (nodes != NULL) {
+        EventNode *node = nodes;
+        nodes = nodes->next;
+
+        // Skip everything that must stay ahead of this node
+        while (*link != NULL && (*link)->event.priority >= node->event.priority) {
+            link = &(*link)->next;
+        }
+        node->next = *link;
+        *link = node;
+        link = &node->next;
+    }
+    queue->size += count;
+
+    // Start shedding as soon as the backlog reaches the watermark, the manager stops it
+    if (queue->watermark > 0 && queue->size >= queue->watermark) {
+        atomic_store_explicit(&queue->shedding, 1, memory_order_relaxed);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,301 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Flight recorder: the last few thousand things every thread did, kept in memory */
+
+// Each named thread owns a ring of fixed-size records. Recording is a thread-local load,
+// a timestamp and a 32-byte store followed by a release store of the ring's head, with no
+// lock and no shared cache line. Rings are only written to disk when something goes wrong:
+// when the run ends with Oxygen depleted, on a fatal signal or on SIGUSR1. The dump only
+// uses async-signal-safe calls, so it works from a signal handler; records being written
+// while the dump runs may come out torn.
+
+static FlightRing *flight_rings[FLIGHT_MAX_THREADS];
+static atomic_int flight_ring_count = 0;
+static _Thread_local FlightRing *flight_ring = NULL;
+static char flight_path[256] = "";
+static const Manager *flight_manager = NULL;
+static atomic_flag flight_dumping = ATOMIC_FLAG_INIT;
+static uint64_t flight_ticks_start;
+static uint64_t flight_ns_start;
+
+static uint64_t flight_ticks(void);
+static uint64_t flight_now_ns(void);
+static void flight_signal_handler(int signal_number);
+static void flight_write(int fd, const void *data, size_t size);
+
+/**
+ * Arms the flight recorder: sets where dumps go and installs the signal handlers.
+ *
+ * Records are kept whether or not the recorder is armed; arming only decides whether they
+ * can be dumped. Forked workers of batch modes should not arm it, or they would all dump
+ * to the same file.
+ *
+ * @param[in] path     File that dumps overwrite.
+ * @param[in] manager  Pointer to the `Manager`, whose resource and system names go in each dump.
+ */
+void flight_recorder_init(const char *path, const Manager *manager) {
+    static const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    struct sigaction action;
+
+    snprintf(flight_path, sizeof(flight_path), "%s", path);
+    flight_manager = manager;
+    flight_ticks_start = flight_ticks();
+    flight_ns_start = flight_now_ns();
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = flight_signal_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+
+    // Fatal signals dump once, then the default action runs when the handler re-raises
+    action.sa_flags = SA_RESETHAND;
+    for (size_t i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); i++) {
+        sigaction(fatal_signals[i], &action, NULL);
+    }
+}
+
+/**
+ * Gives the calling thread a ring to record into.
+ *
+ * A ring left by an earlier thread with the same name is reused, so repeated runs keep
+ * one ring per system. Threads that never call this record nothing.
+ *
+ * @param[in] name  Name of the thread, e.g. its system's name.
+ */
+void flight_thread_start(const char *name) {
+    int count = atomic_load(&flight_ring_count);
+
+    for (int i = 0; i < count; i++) {
+        FlightRing *ring = flight_rings[i];
+        int idle = 0;
+
+        if (ring != NULL && strncmp(ring->name, name, sizeof(ring->name) - 1) == 0 &&
+            atomic_compare_exchange_strong(&ring->in_use, &idle, 1)) {
+            flight_ring = ring;
+            return;
+        }
+    }
+
+    count = atomic_fetch_add(&flight_ring_count, 1);
+    if (count >= FLIGHT_MAX_THREADS) {
+        atomic_fetch_sub(&flight_ring_count, 1);
+        return;
+    }
+
+    flight_ring = (FlightRing *)calloc(1, sizeof(FlightRing));
+    if (flight_ring == NULL) {
+        fprintf(stderr, "Failed to allocate memory for FlightRing.\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(flight_ring->name, sizeof(flight_ring->name), "%s", name);
+    atomic_init(&flight_ring->head, 0);
+    atomic_init(&flight_ring->in_use, 1);
+    flight_rings[count] = flight_ring;
+}
+
+/**
+ * Releases the calling thread's ring for a later thread with the same name. Its records stay.
+ */
+void flight_thread_stop(void) {
+    if (flight_ring != NULL) {
+        atomic_store(&flight_ring->in_use, 0);
+        flight_ring = NULL;
+    }
+}
+
+/**
+ * Records one entry in the calling thread's ring, overwriting the oldest once it is full.
+ *
+ * @param[in] kind     One of the `FLIGHT_*` record kinds.
+ * @param[in] subject  Id of the resource or system the record is about, -1 for none.
+ * @param[in] a        Kind-specific values, see the `FLIGHT_*` kinds.
+ * @param[in] b
+ * @param[in] c
+ * @param[in] d
+ */
+void flight_record(int kind, int subject, int a, int b, int c, int d) {
+    FlightRing *ring = flight_ring;
+    FlightRecord *record;
+    uint64_t head;
+
+    if (ring == NULL) {
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    record = &ring->records[head & (FLIGHT_RECORDS - 1)];
+    record->ticks = flight_ticks();
+    record->kind = (uint16_t)kind;
+    record->subject = (int16_t)subject;
+    record->a = a;
+    record->b = b;
+    record->c = c;
+    record->d = d;
+    record->reserved = 0;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * Records an event in the calling thread's ring.
+ *
+ * @param[in] kind   `FLIGHT_EVENT` or `FLIGHT_HANDLED`.
+ * @param[in] event  Pointer to the `Event`.
+ */
+void flight_record_event(int kind, const Event *event) {
+    flight_record(kind, (event->resource != NULL) ? event->resource->id : -1, event->status, event->amount,
+                  (event->system != NULL) ? event->system->id : -1, event->priority);
+}
+
+/**
+ * Writes every ring to the armed dump file, oldest record first in each ring.
+ *
+ * Safe to call from a signal handler. Does nothing if the recorder is not armed or if
+ * another dump is already being written.
+ *
+ * @param[in] reason         One of the `FLIGHT_REASON_*` codes.
+ * @param[in] signal_number  The signal that caused the dump, zero for none.
+ */
+void flight_recorder_dump(int reason, int signal_number) {
+    FlightDumpHeader header;
+    int fd, rings;
+
+    if (flight_path[0] == '\0' || atomic_flag_test_and_set(&flight_dumping)) {
+        return;
+    }
+
+    fd = open(flight_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        atomic_flag_clear(&flight_dumping);
+        return;
+    }
+
+    rings = atomic_load(&flight_ring_count);
+    memset(&header, 0, sizeof(header));
+    header.magic = FLIGHT_MAGIC;
+    header.version = FLIGHT_VERSION;
+    header.reason = (uint32_t)reason;
+    header.signal_number = (uint32_t)signal_number;
+    header.ring_count = (uint32_t)rings;
+    header.record_size = sizeof(FlightRecord);
+    header.records_per_ring = FLIGHT_RECORDS;
+    header.ticks_start = flight_ticks_start;
+    header.ns_start = flight_ns_start;
+    header.ticks_dump = flight_ticks();
+    header.ns_dump = flight_now_ns();
+    if (flight_manager != NULL) {
+        header.resource_count = (uint32_t)flight_manager->resource_array.size;
+        header.system_count = (uint32_t)flight_manager->system_array.size;
+    }
+    flight_write(fd, &header, sizeof(header));
+
+    // Names, so record subjects can be read back: resources by id, then systems by id
+    for (uint32_t i = 0; i < header.resource_count; i++) {
+        const char *name = flight_manager->resource_array.resources[i]->name;
+        flight_write(fd, name, strlen(name) + 1);
+    }
+    for (uint32_t i = 0; i < header.system_count; i++) {
+        const char *name = flight_manager->system_array.systems[i]->name;
+        flight_write(fd, name, strlen(name) + 1);
+    }
+
+    for (int i = 0; i < rings; i++) {
+        FlightRing *ring = flight_rings[i];
+        FlightRingHeader ring_header;
+        uint64_t head, first, count;
+
+        if (ring == NULL) {
+            continue;
+        }
+        head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        count = (head < FLIGHT_RECORDS) ? head : FLIGHT_RECORDS;
+        first = head - count;
+
+        memset(&ring_header, 0, sizeof(ring_header));
+        memcpy(ring_header.name, ring->name, sizeof(ring_header.name));
+        ring_header.head = head;
+        ring_header.count = count;
+        flight_write(fd, &ring_header, sizeof(ring_header));
+
+        // The ring wraps at most once between `first` and `head`
+        if ((first & (FLIGHT_RECORDS - 1)) + count > FLIGHT_RECORDS) {
+            uint64_t split = FLIGHT_RECORDS - (first & (FLIGHT_RECORDS - 1));
+            flight_write(fd, &ring->records[first & (FLIGHT_RECORDS - 1)], split * sizeof(FlightRecord));
+            flight_write(fd, &ring->records[0], (count - split) * sizeof(FlightRecord));
+        } else {
+            flight_write(fd, &ring->records[first & (FLIGHT_RECORDS - 1)], count * sizeof(FlightRecord));
+        }
+    }
+
+    close(fd);
+    atomic_flag_clear(&flight_dumping);
+}
+
+/**
+ * Dumps the rings when a signal arrives; fatal signals are then re-raised.
+ *
+ * @param[in] signal_number  The signal.
+ */
+static void flight_signal_handler(int signal_number) {
+    flight_recorder_dump((signal_number == SIGUSR1) ? FLIGHT_REASON_REQUEST : FLIGHT_REASON_SIGNAL, signal_number);
+    if (signal_number != SIGUSR1) {
+        raise(signal_number);
+    }
+}
+
+/**
+ * Writes all of a buffer, retrying short writes. Async-signal-safe.
+ *
+ * @param[in] fd    File descriptor.
+ * @param[in] data  The bytes.
+ * @param[in] size  Number of bytes.
+ */
+static void flight_write(int fd, const void *data, size_t size) {
+    const char *bytes = (const char *)data;
+
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0) {
+            return;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+}
+
+/**
+ * Reads the cheapest clock available: the time stamp counter where there is one.
+ *
+ * Dumps carry two (ticks, nanoseconds) pairs, so readers can convert ticks to time.
+ *
+ * @return  The clock's ticks.
+ */
+static uint64_t flight_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return flight_now_ns();
+#endif
+}
+
+/**
+ * Reads `CLOCK_MONOTONIC` in nanoseconds. Async-signal-safe.
+ *
+ * @return  The time.
+ */
+static uint64_t flight_now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,451 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Lockstep engine: advances LOCKSTEP_LANES variants of a scenario together, one virtual
+// millisecond at a time. Every per-system and per-resource quantity is a vector with one
+// lane per variant, so a single instruction stream updates all variants. Branches are
+// replaced with per-lane masks, and lanes that have finished are masked out.
+//
+// The model follows `system_run` and `manager_run`: a system consumes, processes for its
+// (status adjusted) processing time, then stores; failures make it wait SYSTEM_WAIT_TIME and
+// the manager's reaction (FAST, SLOW, TERMINATE) is applied to the producers immediately.
+//
+// The topology and base parameters come from a shared `ScenarioTemplate`. Lanes can be saved
+// to and restored from `ScenarioState`s, and processing times can be given a per-lane random
+// jitter, so a state restored several times follows a different path each time.
+
+static void lockstep_step(LockstepEngine *engine);
+static void lockstep_finish(LockstepEngine *engine, const LaneVector *mask, int outcome);
+static void lockstep_set_producers(LockstepEngine *engine, int resource, const LaneVector *mask, int status);
+static void lockstep_load_parameters(LockstepEngine *engine, int lane);
+static LaneVector *lockstep_alloc(int count);
+
+// Per-lane helpers. These are macros rather than functions because passing or returning
+// wide vectors by value depends on which SIMD extensions the compiler targets.
+
+// `a` in the lanes where `mask` is set, `b` in the others
+#define LANE_SELECT(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+// The smaller of `a` and `b` in each lane
+#define LANE_MIN(a, b) LANE_SELECT((a) < (b), (a), (b))
+
+/**
+ * Initializes a `LockstepEngine` for a scenario template.
+ *
+ * The first `lanes` lanes start in the template's initial state and can be changed with
+ * `lockstep_load_lane` or `lockstep_restore_lane`; the remaining lanes are left finished so
+ * they never run. The template is shared, not copied, and must outlive the engine.
+ *
+ * @param[out] engine    Pointer to the `LockstepEngine` to initialize.
+ * @param[in]  scenario  Pointer to the `ScenarioTemplate`.
+ * @param[in]  lanes     Number of lanes to use, at most `LOCKSTEP_LANES`.
+ */
+void lockstep_init(LockstepEngine *engine, const ScenarioTemplate *scenario, int lanes) {
+    engine->scenario = scenario;
+    engine->resource_count = scenario->resource_count;
+    engine->system_count = scenario->system_count;
+    engine->consumed_index = scenario->consumed_index;
+    engine->produced_index = scenario->produced_index;
+    engine->oxygen = scenario->oxygen;
+    engine->distance = scenario->distance;
+
+    engine->amount = lockstep_alloc(engine->resource_count);
+    engine->capacity = lockstep_alloc(engine->resource_count);
+    engine->stored = lockstep_alloc(engine->system_count);
+    engine->timer = lockstep_alloc(engine->system_count);
+    engine->wait = lockstep_alloc(engine->system_count);
+    engine->status = lockstep_alloc(engine->system_count);
+    engine->processing_time = lockstep_alloc(engine->system_count);
+    engine->consumed_amount = lockstep_alloc(engine->system_count);
+    engine->produced_amount = lockstep_alloc(engine->system_count);
+    engine->jitter = 0;
+    engine->oxygen_floor = -1;
+    engine->tick = 0;
+
+    for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+        lockstep_load_parameters(engine, lane);
+        for (int r = 0; r < engine->resource_count; r++) {
+            engine->amount[r][lane] = scenario->initial_amount[r];
+        }
+        for (int s = 0; s < engine->system_count; s++) {
+            engine->stored[s][lane] = scenario->initial_stored[s];
+            engine->status[s][lane] = scenario->initial_status[s];
+        }
+        engine->min_oxygen[lane] = (engine->oxygen >= 0) ? engine->amount[engine->oxygen][lane] : 0;
+        lockstep_seed_lane(engine, lane, (uint32_t)lane);
+        engine->active[lane] = (lane < lanes) ? -1 : 0;
+        engine->outcome[lane] = (lane < lanes) ? OUTCOME_RUNNING : OUTCOME_FAILED;
+    }
+}
+
+/**
+ * Frees the memory used by a `LockstepEngine`.
+ *
+ * @param[in,out] engine  Pointer to the `LockstepEngine` to clean.
+ */
+void lockstep_clean(LockstepEngine *engine) {
+    free(engine->amount);
+    free(engine->capacity);
+    free(engine->stored);
+    free(engine->timer);
+    free(engine->wait);
+    free(engine->status);
+    free(engine->processing_time);
+    free(engine->consumed_amount);
+    free(engine->produced_amount);
+}
+
+/**
+ * Copies the current numeric parameters and state of the scenario in `manager` into one lane.
+ *
+ * The topology (which resource each system consumes and produces) must match the
+ * template the engine was initialized with; only the numbers may differ.
+ *
+ * @param[in,out] engine   Pointer to the `LockstepEngine`.
+ * @param[in]     lane     Lane to load.
+ * @param[in]     manager  Pointer to the `Manager` holding the variant.
+ */
+void lockstep_load_lane(LockstepEngine *engine, int lane, const Manager *manager) {
+    for (int r = 0; r < engine->resource_count; r++) {
+        Resource *resource = manager->resource_array.resources[r];
+        engine->amount[r][lane] = atomic_load(&resource->amount);
+        engine->capacity[r][lane] = resource->max_capacity;
+    }
+
+    for (int s = 0; s < engine->system_count; s++) {
+        System *system = manager->system_array.systems[s];
+        int status = atomic_load_explicit(&system->status, memory_order_relaxed);
+
+        engine->stored[s][lane] = atomic_load_explicit(&system->amount_stored, memory_order_relaxed);
+        engine->timer[s][lane] = 0;
+        engine->wait[s][lane] = 0;
+        engine->status[s][lane] = (status == TERMINATE) ? STANDARD : status;
+        engine->processing_time[s][lane] = system->processing_time;
+        engine->consumed_amount[s][lane] = system->consumed.amount;
+        engine->produced_amount[s][lane] = system->produced.amount;
+    }
+
+    engine->elapsed[lane] = 0;
+    engine->min_oxygen[lane] = (engine->oxygen >= 0) ? engine->amount[engine->oxygen][lane] : 0;
+}
+
+/**
+ * Advances every lane until all of them finish.
+ *
+ * The time limit applies to each lane's own elapsed time, so lanes restored from
+ * states saved at different times each get the rest of their own run.
+ *
+ * @param[in,out] engine     Pointer to the `LockstepEngine`.
+ * @param[in]     max_ticks  Longest run in virtual milliseconds; lanes still running then end with `OUTCOME_TIME_LIMIT`.
+ */
+void lockstep_run(LockstepEngine *engine, long long max_ticks) {
+    LaneVector zero = {0};
+    int limit = (max_ticks < INT32_MAX) ? (int)max_ticks : INT32_MAX;
+
+    for (;;) {
+        LaneVector expired = engine->elapsed >= zero + limit;
+        lockstep_finish(engine, &expired, OUTCOME_TIME_LIMIT);
+
+        lockstep_step(engine);
+        engine->tick++;
+
+        // Checking for finished lanes is a horizontal operation, so only do it now and then
+        if ((engine->tick & 63) == 0) {
+            int any_active = 0;
+            for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+                any_active |= engine->active[lane];
+            }
+            if (!any_active) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Reads the result of one lane.
+ *
+ * @param[in]  engine  Pointer to the `LockstepEngine`.
+ * @param[in]  lane    Lane to read.
+ * @param[out] result  Receives the lane's result, with `elapsed_ms` in virtual milliseconds.
+ */
+void lockstep_result(const LockstepEngine *engine, int lane, RunResult *result) {
+    result->outcome = engine->outcome[lane];
+    result->elapsed_ms = engine->elapsed[lane];
+    result->min_oxygen = engine->min_oxygen[lane];
+    result->distance = (engine->distance >= 0) ? engine->amount[engine->distance][lane] : 0;
+    result->worker_faults = 0;
+    result->worker_rss_kb = 0;
+}
+
+/**
+ * Adds random variation to every processing time from now on.
+ *
+ * Each time a system starts processing in a lane, its processing time is moved by a
+ * uniformly distributed amount of up to `percent` of itself, drawn from the lane's seed.
+ *
+ * @param[in,out] engine   Pointer to the `LockstepEngine`.
+ * @param[in]     percent  Largest change in percent, 0 to turn the variation off.
+ */
+void lockstep_set_jitter(LockstepEngine *engine, int percent) {
+    if (percent < 0) {
+        percent = 0;
+    } else if (percent > 100) {
+        percent = 100;
+    }
+    engine->jitter = percent * 65536 / 100;
+}
+
+/**
+ * Seeds the random variation of one lane.
+ *
+ * @param[in,out] engine  Pointer to the `LockstepEngine`.
+ * @param[in]     lane    Lane to seed.
+ * @param[in]     seed    Any value; nearby seeds give unrelated sequences.
+ */
+void lockstep_seed_lane(LockstepEngine *engine, int lane, uint32_t seed) {
+    // Scramble the seed so consecutive seeds do not start out correlated
+    seed ^= seed >> 16;
+    seed *= 0x7FEB352Du;
+    seed ^= seed >> 15;
+    seed *= 0x846CA68Bu;
+    seed ^= seed >> 16;
+
+    // Xorshift never leaves the all-zero state
+    engine->random[lane] = (seed != 0) ? seed : 0x9E3779B9u;
+}
+
+/**
+ * Saves the state of one lane, so it can later be continued in any lane.
+ *
+ * Only the state is saved; the lane's parameters are the template's.
+ *
+ * @param[in]  engine  Pointer to the `LockstepEngine`.
+ * @param[in]  lane    Lane to save.
+ * @param[out] state   A state of the engine's template.
+ */
+void lockstep_save_lane(const LockstepEngine *engine, int lane, ScenarioState *state) {
+    int *system_values = state->values + engine->resource_count;
+
+    for (int r = 0; r < engine->resource_count; r++) {
+        state->values[r] = engine->amount[r][lane];
+    }
+    for (int s = 0; s < engine->system_count; s++) {
+        system_values[SCENARIO_STORED] = engine->stored[s][lane];
+        system_values[SCENARIO_TIMER] = engine->timer[s][lane];
+        system_values[SCENARIO_WAIT] = engine->wait[s][lane];
+        system_values[SCENARIO_STATUS] = engine->status[s][lane];
+        system_values += SCENARIO_SYSTEM_FIELDS;
+    }
+    state->elapsed = engine->elapsed[lane];
+    state->min_oxygen = engine->min_oxygen[lane];
+    state->outcome = engine->outcome[lane];
+}
+
+/**
+ * Continues a saved state in `lane`, with the template's parameters.
+ *
+ * The lane starts running again unless the state had already ended. It keeps its own
+ * random state, so several lanes restored from one state diverge once jitter is on.
+ *
+ * @param[in,out] engine  Pointer to the `LockstepEngine`.
+ * @param[in]     lane    Lane to restore into.
+ * @param[in]     state   State written by `lockstep_save_lane` or `scenario_state_init`.
+ */
+void lockstep_restore_lane(LockstepEngine *engine, int lane, const ScenarioState *state) {
+    const int *system_values = state->values + engine->resource_count;
+
+    lockstep_load_parameters(engine, lane);
+    for (int r = 0; r < engine->resource_count; r++) {
+        engine->amount[r][lane] = state->values[r];
+    }
+    for (int s = 0; s < engine->system_count; s++) {
+        engine->stored[s][lane] = system_values[SCENARIO_STORED];
+        engine->timer[s][lane] = system_values[SCENARIO_TIMER];
+        engine->wait[s][lane] = system_values[SCENARIO_WAIT];
+        engine->status[s][lane] = system_values[SCENARIO_STATUS];
+        system_values += SCENARIO_SYSTEM_FIELDS;
+    }
+    engine->elapsed[lane] = state->elapsed;
+    engine->min_oxygen[lane] = state->min_oxygen;
+
+    // A lane saved after it ended the run (rather than just crossing a threshold) stays ended
+    engine->outcome[lane] = (state->outcome == OUTCOME_THRESHOLD) ? OUTCOME_RUNNING : state->outcome;
+    engine->active[lane] = (engine->outcome[lane] == OUTCOME_RUNNING) ? -1 : 0;
+}
+
+/**
+ * Advances every lane by one virtual millisecond.
+ *
+ * Built twice, for AVX2 and for the baseline target, and picked at load time: without
+ * AVX2 each 8-lane vector is split into narrower operations and runs several times slower.
+ *
+ * @param[in,out] engine  Pointer to the `LockstepEngine`.
+ */
+__attribute__((target_clones("avx2", "default")))
+static void lockstep_step(LockstepEngine *engine) {
+    LaneVector zero = {0};
+    LaneVector one = zero + 1;
+
+    for (int s = 0; s < engine->system_count; s++) {
+        int consumed = engine->consumed_index[s];
+        int produced = engine->produced_index[s];
+        LaneVector active = engine->active;
+        LaneVector status = engine->status[s];
+        LaneVector processing = engine->processing_time[s];
+        LaneVector idle, started, running, finished;
+
+        engine->wait[s] -= active & (engine->wait[s] > zero) & one;
+        idle = active & (engine->stored[s] == zero) & (engine->timer[s] == zero) & (engine->wait[s] == zero);
+        started = idle;
+
+        // Consume, or report EMPTY / INSUFFICIENT and wait
+        if (consumed >= 0) {
+            LaneVector need = engine->consumed_amount[s];
+            LaneVector have = engine->amount[consumed] >= need;
+            LaneVector failed = idle & ~have;
+
+            started = idle & have;
+            engine->amount[consumed] -= started & need;
+
+            if (consumed == engine->oxygen) {
+                LaneVector depleted = failed & (engine->amount[consumed] == zero);
+                lockstep_finish(engine, &depleted, OUTCOME_NO_OXYGEN);
+            }
+            failed &= engine->active;
+            lockstep_set_producers(engine, consumed, &failed, FAST);
+            engine->wait[s] = LANE_SELECT(failed, zero + SYSTEM_WAIT_TIME, engine->wait[s]);
+        }
+
+        // Process for the status adjusted time, then hold the produced amount
+        processing = LANE_SELECT(status == SLOW, processing * 2, LANE_SELECT(status == FAST, processing >> 1, processing));
+        if (engine->jitter > 0) {
+            // Uniform in [-span, span], scaled with multiplies since vector division is scalar;
+            // exact for processing times below 32768 ms
+            LaneVector span = (processing * engine->jitter) >> 16;
+            LaneBits next = engine->random;
+            LaneVector draw;
+
+            // Finished lanes keep their state, so a lane's draws depend only on its own run
+            next ^= next << 13;
+            next ^= next >> 17;
+            next ^= next << 5;
+            engine->random = LANE_SELECT((LaneBits)active, next, engine->random);
+            draw = (LaneVector)(engine->random >> 16);
+            processing += ((draw * (2 * span + 1)) >> 16) - span;
+        }
+        engine->timer[s] = LANE_SELECT(started, processing, engine->timer[s]);
+        running = active & (engine->timer[s] > zero);
+        engine->timer[s] -= running & one;
+        finished = (started | running) & (engine->timer[s] == zero);
+
+        if (produced < 0) {
+            continue;
+        }
+        engine->stored[s] += finished & engine->produced_amount[s];
+
+        // Store as much as fits, report CAPACITY and wait if some is left over
+        {
+            LaneVector storing = engine->active & (engine->stored[s] > zero) & (engine->timer[s] == zero) & (engine->wait[s] == zero);
+            LaneVector space = engine->capacity[produced] - engine->amount[produced];
+            LaneVector put = storing & LANE_MIN(engine->stored[s], LANE_SELECT(space > zero, space, zero));
+            LaneVector full;
+
+            engine->amount[produced] += put;
+            engine->stored[s] -= put;
+            full = storing & (engine->stored[s] > zero);
+
+            if (produced == engine->distance) {
+                lockstep_finish(engine, &full, OUTCOME_DESTINATION);
+            }
+            full &= engine->active;
+            lockstep_set_producers(engine, produced, &full, SLOW);
+            engine->wait[s] = LANE_SELECT(full, zero + SYSTEM_WAIT_TIME, engine->wait[s]);
+        }
+    }
+
+    if (engine->oxygen >= 0) {
+        engine->min_oxygen = LANE_SELECT(engine->active, LANE_MIN(engine->min_oxygen, engine->amount[engine->oxygen]), engine->min_oxygen);
+    }
+    engine->elapsed += engine->active & one;
+
+    if (engine->oxygen >= 0 && engine->oxygen_floor >= 0) {
+        LaneVector crossed = engine->amount[engine->oxygen] <= zero + engine->oxygen_floor;
+        lockstep_finish(engine, &crossed, OUTCOME_THRESHOLD);
+    }
+}
+
+/**
+ * Ends the lanes in `mask` that are still running with `outcome`.
+ *
+ * @param[in,out] engine   Pointer to the `LockstepEngine`.
+ * @param[in]     mask     Pointer to the lanes to end.
+ * @param[in]     outcome  The `OUTCOME_*` code to record.
+ */
+static void lockstep_finish(LockstepEngine *engine, const LaneVector *mask, int outcome) {
+    LaneVector zero = {0};
+    LaneVector ending = *mask & engine->active;
+
+    engine->outcome = LANE_SELECT(ending, zero + outcome, engine->outcome);
+    engine->active &= ~ending;
+}
+
+/**
+ * Sets the status of every system producing `resource`, in the lanes in `mask`.
+ *
+ * @param[in,out] engine    Pointer to the `LockstepEngine`.
+ * @param[in]     resource  Index of the resource.
+ * @param[in]     mask      Pointer to the lanes to update.
+ * @param[in]     status    The new status.
+ */
+static void lockstep_set_producers(LockstepEngine *engine, int resource, const LaneVector *mask, int status) {
+    LaneVector zero = {0};
+
+    for (int s = 0; s < engine->system_count; s++) {
+        if (engine->produced_index[s] == resource) {
+            engine->status[s] = LANE_SELECT(*mask, zero + status, engine->status[s]);
+        }
+    }
+}
+
+/**
+ * Sets one lane's parameters to the template's and clears its timers.
+ *
+ * @param[in,out] engine  Pointer to the `LockstepEngine`.
+ * @param[in]     lane    Lane to load.
+ */
+static void lockstep_load_parameters(LockstepEngine *engine, int lane) {
+    const ScenarioTemplate *scenario = engine->scenario;
+
+    for (int r = 0; r < engine->resource_count; r++) {
+        engine->capacity[r][lane] = scenario->capacity[r];
+    }
+    for (int s = 0; s < engine->system_count; s++) {
+        engine->timer[s][lane] = 0;
+        engine->wait[s][lane] = 0;
+        engine->processing_time[s][lane] = scenario->processing_time[s];
+        engine->consumed_amount[s][lane] = scenario->consumed_amount[s];
+        engine->produced_amount[s][lane] = scenario->produced_amount[s];
+    }
+    engine->elapsed[lane] = 0;
+}
+
+/**
+ * Allocates an array of `LaneVector`, aligned for vector loads and stores.
+ *
+ * @param[in] count  Number of vectors.
+ * @return           The zeroed array.
+ */
+static LaneVector *lockstep_alloc(int count) {
+    size_t size = (count > 0 ? count : 1) * sizeof(LaneVector);
+    LaneVector *vectors = (LaneVector *)aligned_alloc(sizeof(LaneVector), size);
+
+    if (vectors == NULL) {
+        fprintf(stderr, "Failed to allocate memory for LockstepEngine vectors.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(vectors, 0, size);
+    return vectors;
+}
@@ -3,67 +3,201 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
-
-// Global resource
-sem_t resource_sem;
-
+#include <unistd.h>
 
 void load_data(Manager *manager);
+static void usage(const char *program);
+static int set_processing(Manager *manager, const char *spec);
 
-int main(void) {
-    // Initialize semaphore
-    if (sem_init(&resource_sem, 0, 1) != 0) {
-        perror("Failed to initialize semaphore");
-        exit(EXIT_FAILURE);
+int main(int argc, char *argv[]) {
+    const char *record_path = NULL;
+    int sample_interval = SAMPLER_DEFAULT_INTERVAL;
+    int time_limit = 0, warmup = 0;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double sensitivity = 0.0;
+    int optimize = 0, lockstep = 0, batch = 0;
+    int shed_watermark = EVENT_SHED_WATERMARK, channels = 0, inline_manager = 0;
+    int stall_periods = STALL_PERIODS, watchdog = 1;
+    int splitting = 0, levels = SPLITTING_DEFAULT_LEVELS, jitter = SPLITTING_DEFAULT_JITTER;
+    double spread = 0.2;
+    unsigned int seed = 1;
+    const char *flight_path = NULL;
+    const char *trace_path = NULL;
+    int use_uring = 1;
+    OutputWriter output;
+    EventTrace trace;
+    const char *processing[argc];
+    int processing_count = 0;
+    Sampler sampler;
+    RunResult result;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--sample-ms") == 0 && i + 1 < argc) {
+            sample_interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--time-limit") == 0 && i + 1 < argc) {
+            time_limit = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sensitivity") == 0 && i + 1 < argc) {
+            sensitivity = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--optimize") == 0 && i + 1 < argc) {
+            optimize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spread") == 0 && i + 1 < argc) {
+            spread = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--splitting") == 0 && i + 1 < argc) {
+            splitting = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--levels") == 0 && i + 1 < argc) {
+            levels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            jitter = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = 1;
+        } else if (strcmp(argv[i], "--processing") == 0 && i + 1 < argc) {
+            processing[processing_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--shed-watermark") == 0 && i + 1 < argc) {
+            shed_watermark = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--channels") == 0) {
+            channels = 1;
+        } else if (strcmp(argv[i], "--no-manager-thread") == 0) {
+            inline_manager = 1;
+        } else if (strcmp(argv[i], "--stall-periods") == 0 && i + 1 < argc) {
+            stall_periods = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-io-uring") == 0) {
+            use_uring = 0;
+        } else if (strcmp(argv[i], "--no-watchdog") == 0) {
+            watchdog = 0;
+        } else if (strcmp(argv[i], "--flight") == 0 && i + 1 < argc) {
+            flight_path = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
     }
 
     Manager manager;
     manager_init(&manager);
     load_data(&manager);
+    manager.time_limit_ms = time_limit;
+    event_queue_set_shedding(&manager.event_queue, shed_watermark, EVENT_SHED_SAMPLE);
+    manager.use_channels = channels;
+    manager.inline_manager = inline_manager;
+    manager.stall_periods = stall_periods;
+    manager.watchdog = watchdog;
+    simulation_seed(&manager, seed);
+    for (int i = 0; i < processing_count; i++) {
+        if (set_processing(&manager, processing[i]) != 0) {
+            fprintf(stderr, "Invalid --processing %s\n", processing[i]);
+            usage(argv[0]);
+            manager_clean(&manager);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Create manager thread
-    pthread_t manager_tid;
-    if (pthread_create(&manager_tid, NULL, manager_thread, (void*)&manager) != 0) {
-        perror("Failed to create manager thread");
-        sem_destroy(&resource_sem);
+    // The lockstep engine only knows fixed processing times, see --jitter for its variation
+    if (processing_count > 0 && ((sensitivity > 0.0 && lockstep) || splitting > 0)) {
+        fprintf(stderr, "--processing cannot be used with --lockstep or --splitting, which run on the lockstep engine.\n");
         manager_clean(&manager);
         exit(EXIT_FAILURE);
     }
 
-    // Create system threads
-    int num_systems = manager.system_array.size;
-    pthread_t system_tids[num_systems];
-
-    for (int i = 0; i < num_systems; ++i) {
-        if (pthread_create(&system_tids[i], NULL, system_thread, (void*)manager.system_array.systems[i]) != 0) {
-            perror("Failed to create system thread");
-            // Signal termination to already created threads
-            manager.simulation_running = 0;
-            // Wait for already created threads to terminate
-            for (int j = 0; j < i; ++j) {
-                pthread_join(system_tids[j], NULL);
-            }
-            pthread_join(manager_tid, NULL);
-            sem_destroy(&resource_sem);
-            manager_clean(&manager);
+    if (sensitivity > 0.0) {
+        sensitivity_run(&manager, sensitivity, warmup, jobs, lockstep);
+        manager_clean(&manager);
+        return 0;
+    }
+
+    if (batch > 0) {
+        batch_run(&manager, batch, spread, jobs, seed);
+        manager_clean(&manager);
+        return 0;
+    }
+
+    if (optimize > 0) {
+        optimizer_run(&manager, optimize, jobs, seed);
+        manager_clean(&manager);
+        return 0;
+    }
+
+    if (splitting > 0) {
+        splitting_run(&manager, splitting, levels, jitter, seed);
+        manager_clean(&manager);
+        return 0;
+    }
+
+    // Recordings and traces share one writer, so neither waits for the disk
+    if (record_path != NULL || trace_path != NULL) {
+        output_init(&output, use_uring);
+    }
+    if (record_path != NULL) {
+        sampler_start(&sampler, &manager, &output, record_path, sample_interval);
+    }
+    if (trace_path != NULL) {
+        if (trace_open(&trace, &output, &manager, trace_path) != 0) {
+            perror("Failed to open trace file");
             exit(EXIT_FAILURE);
         }
+        manager.trace = &trace;
     }
 
-    // Wait for manager thread to finish
-    pthread_join(manager_tid, NULL);
+    // Only single runs arm the flight recorder, forked workers would all dump to one file.
+    // Crashes and SIGUSR1 always dump; running out of Oxygen, which the default scenario
+    // ends with, only when the file was asked for.
+    manager.flight_on_depletion = (flight_path != NULL);
+    flight_recorder_init((flight_path != NULL) ? flight_path : FLIGHT_DEFAULT_PATH, &manager);
+    flight_thread_start("main");
+
+    simulation_run(&manager, &result);
 
-    // Wait for all system threads to finish
-    for (int i = 0; i < num_systems; ++i) {
-        pthread_join(system_tids[i], NULL);
+    if (record_path != NULL) {
+        sampler_stop(&sampler);
+    }
+    if (trace_path != NULL) {
+        manager.trace = NULL;
+        if (trace_close(&trace) != 0) {
+            fprintf(stderr, "Failed to write the trace.\n");
+        }
+        printf("Trace: %lld events in %lld bytes (%.1fx smaller than uncompressed)\n", trace.events, trace.bytes,
+               trace.bytes > 0 ? (double)trace.events * sizeof(TraceRecord) / trace.bytes : 0.0);
+    }
+    if (record_path != NULL || trace_path != NULL) {
+        printf("Output: %s, %lld page writes in %lld submissions, producers waited %lld times\n",
+               output_backend_name(&output), output.writes, output.submit_calls, output.waits);
+        output_clean(&output);
+    }
+
+    // Where each system's time went: CPU-bound, lock-bound, starved or behind its schedule.
+    // The system threads have been joined, so the counters are read directly.
+    printf("%-14s %6s %6s %9s %9s %9s %9s %14s\n",
+           "System", "Conv", "Rate", "CPU ms", "Sleep ms", "Wait ms", "Lock ms", "Lag ms (max)");
+    for (int i = 0; i < manager.system_array.size; i++) {
+        System *system = manager.system_array.systems[i];
+        printf("%-14s %6lld %5.0f%% %9.1f %9.1f %9.1f %9.2f %6.2f (%5.2f)\n",
+               system->name, system->conversions, system_rate(system) * 100, system->cpu_ns / 1e6,
+               system->sleep_ns / 1e6, system->starved_ns / 1e6, system->blocked_ns / 1e6,
+               system->lag_ns / 1e6, system->max_lag_ns / 1e6);
     }
 
     // Cleanup
-    sem_destroy(&resource_sem);
     manager_clean(&manager);
 
     printf("Simulation terminated and resources cleaned up.\n");
-    return 0;
+    printf("Outcome: %s after %lld ms, distance %d, oxygen margin %d\n",
+           outcome_name(result.outcome), result.elapsed_ms, result.distance, result.min_oxygen);
+    printf("Events: peak backlog %d, %ld low priority events shed\n", result.event_backlog_peak, result.events_shed);
+    if (result.watchdog_alerts > 0) {
+        printf("Watchdog: %ld stalls reported\n", result.watchdog_alerts);
+    }
+    return (result.outcome == OUTCOME_FAILED) ? EXIT_FAILURE : 0;
 }
 
 
@@ -83,6 +217,85 @@ int main(void) {
 //     return 0;
 // }
 //
+/**
+ * Prints the command line options.
+ *
+ * @param[in] program  Name the program was run as.
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [options]\n", program);
+    fprintf(stderr, "  --record FILE        Record resource amounts and system statuses to FILE\n");
+    fprintf(stderr, "  --trace FILE         Write every event the manager handles to FILE\n");
+    fprintf(stderr, "  --no-io-uring        Write recordings and traces with a pwrite thread instead of io_uring\n");
+    fprintf(stderr, "  --sample-ms N        Milliseconds between recorded samples (default %d)\n", SAMPLER_DEFAULT_INTERVAL);
+    fprintf(stderr, "  --time-limit MS      Stop each run after MS milliseconds\n");
+    fprintf(stderr, "  --sensitivity EPS    Rank parameters by their effect when moved by +/-EPS (e.g. 0.1)\n");
+    fprintf(stderr, "  --warmup MS          Run the base scenario for MS milliseconds before forking variants\n");
+    fprintf(stderr, "  --lockstep           Run sensitivity variants in virtual time on the SIMD lockstep engine\n");
+    fprintf(stderr, "  --jobs N             Largest number of variants running at once (default: CPU count)\n");
+    fprintf(stderr, "  --batch N            Run N randomized variants in forked workers sharing the loaded scenario\n");
+    fprintf(stderr, "  --spread F           Largest relative change of each parameter in --batch (default 0.2)\n");
+    fprintf(stderr, "  --optimize N         Search N configurations for the fastest safe trip\n");
+    fprintf(stderr, "  --splitting N        Estimate the probability of running out of Oxygen with N particles per level\n");
+    fprintf(stderr, "  --levels K           Oxygen thresholds used by --splitting (default %d)\n", SPLITTING_DEFAULT_LEVELS);
+    fprintf(stderr, "  --jitter PCT         Random +/-PCT%% variation of processing times in --splitting (default %d)\n", SPLITTING_DEFAULT_JITTER);
+    fprintf(stderr, "  --processing S=D[:W] Draw system S's processing times from distribution D (fixed, uniform,\n");
+    fprintf(stderr, "                       normal, exponential) with half-width or deviation W ms; S may be \"all\"\n");
+    fprintf(stderr, "  --shed-watermark N   Shed low priority events while N or more are waiting, 0 to never shed (default %d)\n", EVENT_SHED_WATERMARK);
+    fprintf(stderr, "  --channels           Give every system its own wait-free channel to the manager\n");
+    fprintf(stderr, "  --no-manager-thread  Handle events in the system thread that reports them, with no manager thread\n");
+    fprintf(stderr, "  --stall-periods K    End a run once no system progresses for K retry periods, 0 to never (default %d)\n", STALL_PERIODS);
+    fprintf(stderr, "  --no-watchdog        Do not report systems or the manager that stop stepping\n");
+    fprintf(stderr, "  --flight FILE        Dump the flight recorder to FILE on a crash or SIGUSR1 (default %s), and also on Oxygen depletion\n", FLIGHT_DEFAULT_PATH);
+    fprintf(stderr, "  --seed N             Seed for randomized modes and processing times (default 1)\n");
+}
+
+/**
+ * Applies a `--processing SYSTEM=DISTRIBUTION[:SPREAD]` option.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ * @param[in]     spec     The option's value.
+ * @return                 0 on success, -1 if the value is malformed or names no system.
+ */
+static int set_processing(Manager *manager, const char *spec) {
+    char name[64], distribution_name[32];
+    const char *equals = strchr(spec, '=');
+    const char *colon;
+    int distribution, spread = 0, matched = 0;
+    size_t length;
+
+    if (equals == NULL || (size_t)(equals - spec) >= sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, spec, equals - spec);
+    name[equals - spec] = '\0';
+
+    colon = strchr(equals + 1, ':');
+    length = (colon != NULL) ? (size_t)(colon - equals - 1) : strlen(equals + 1);
+    if (length >= sizeof(distribution_name)) {
+        return -1;
+    }
+    memcpy(distribution_name, equals + 1, length);
+    distribution_name[length] = '\0';
+    if (colon != NULL) {
+        spread = atoi(colon + 1);
+    }
+
+    distribution = random_distribution_from_name(distribution_name);
+    if (distribution < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        if (strcmp(name, "all") == 0 || strcmp(name, system->name) == 0) {
+            system_set_processing(system, distribution, spread);
+            matched = 1;
+        }
+    }
+    return matched ? 0 : -1;
+}
+
 /**
  * Loads sample data for the simulation.
  *
@@ -103,6 +316,10 @@ void load_data(Manager *manager) {
     resource_array_add(&manager->resource_array, energy);
     resource_array_add(&manager->resource_array, distance);
 
+    // Roles tell the manager's policy what running out or filling up means
+    resource_set_role(oxygen, RESOURCE_ROLE_LIFE);
+    resource_set_role(distance, RESOURCE_ROLE_DESTINATION);
+
     // Create systems
     System *propulsion_system, *life_support_system, *crew_capsule_system, *generator_system;
     ResourceAmount consume_fuel, produce_distance;
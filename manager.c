@@ -5,9 +5,7 @@
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
-#include <semaphore.h>
-
-extern sem_t resource_sem; // Semaphore for synchronizing resource access
+#include <errno.h>
 
 /**
  * Thread function for the manager.
@@ -17,22 +15,161 @@ extern sem_t resource_sem; // Semaphore for synchronizing resource access
  */
 void* manager_thread(void* arg) {
     Manager* manager = (Manager*)arg;
+    struct timespec deadline, now;
 
-    while (manager->simulation_running) {
-        // Synchronize access to shared resources
-        sem_wait(&resource_sem);
-
+    flight_thread_start("manager");
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
         // Call manager_run() to perform manager-specific operations
+        atomic_store_explicit(&manager->activity, ACTIVITY_HANDLING, memory_order_relaxed);
         manager_run(manager);
+        atomic_store_explicit(&manager->activity, ACTIVITY_CHECKING, memory_order_relaxed);
+        manager_check(manager);
+        atomic_fetch_add_explicit(&manager->heartbeat, 1, memory_order_relaxed);
+
+        // Wake every MANAGER_WAIT_TIME on an absolute schedule; after a slow pass, start again from now
+        timespec_add_ms(&deadline, MANAGER_WAIT_TIME);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (timespec_elapsed_ns(&deadline, &now) > 0) {
+            deadline = now;
+        }
+        atomic_store_explicit(&manager->activity, ACTIVITY_SLEEPING, memory_order_relaxed);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+            // Interrupted by a signal, keep sleeping towards the same deadline
+        }
+    }
 
-        sem_post(&resource_sem);
+    if (manager->display) {
+        printf("Manager thread terminating.\n");
+    }
+    flight_thread_stop();
+    pthread_exit(NULL);
+}
+
+/**
+ * Runs the manager's checks that follow every pass: the monitor, the time limit and stalls.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ */
+void manager_check(Manager *manager) {
+    struct timespec now;
+    long long elapsed;
+
+    // Let the monitor stop the run early, it also sees the pass that ended the run
+    if (manager->monitor != NULL) {
+        int outcome = manager->monitor(manager, manager->monitor_context);
+        if (outcome != OUTCOME_RUNNING && atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+            manager_terminate(manager, outcome);
+        }
+    }
 
-        // Sleep for a short duration to simulate time between operations
-        sleep(1);
+    // Stop the run once it reaches its time limit
+    if (manager->time_limit_ms > 0 && atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = timespec_elapsed_ns(&manager->start, &now) / 1000000LL;
+        if (elapsed >= manager->time_limit_ms) {
+            manager_terminate(manager, OUTCOME_TIME_LIMIT);
+        }
     }
 
-    printf("Manager thread terminating.\n");
-    pthread_exit(NULL);
+    // Give up on runs where nothing moves any more
+    stall_check(manager);
+}
+
+/**
+ * Runs one manager pass inline, if any events are waiting, and the run's checks, waking
+ * `manager_wait` if they stop the run. The combining lock must be held.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ */
+static void manager_inline_pass(Manager *manager) {
+    if (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+        if (manager_pending(manager)) {
+            manager_run(manager);
+        }
+        manager_check(manager);
+        if (!atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+            pthread_mutex_lock(&manager->wait_lock);
+            pthread_cond_broadcast(&manager->stopped);
+            pthread_mutex_unlock(&manager->wait_lock);
+        }
+    }
+}
+
+/**
+ * Handles the waiting events in the calling thread, when running without a manager thread.
+ *
+ * Called by a system thread right after it publishes events. The first thread to take the
+ * combining lock runs manager passes for everyone until nothing is left; the others return
+ * at once, their events are handled by the combiner. The pending check after unlocking
+ * catches events published while the lock was being given up.
+ *
+ * @param[in,out] context  Pointer to the `Manager`.
+ */
+void manager_combine(void *context) {
+    Manager *manager = (Manager *)context;
+
+    do {
+        if (pthread_mutex_trylock(&manager->combine_lock) != 0) {
+            return;
+        }
+        manager_inline_pass(manager);
+        pthread_mutex_unlock(&manager->combine_lock);
+    } while (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed) && manager_pending(manager));
+}
+
+/**
+ * Blocks until a run without a manager thread stops, enforcing its time limit.
+ *
+ * Sleeps on a condition instead of polling; combiners wake it when they stop the run.
+ * When stalls are checked it also wakes once per stall period, since a stalled run
+ * publishes no events that would run the checks. It sleeps under its own lock, never
+ * the combining lock, so a system can always combine while it sleeps, and like a
+ * combiner it checks for pending events after every pass it runs.
+ *
+ * @param[in,out] manager  Pointer to the running `Manager`.
+ */
+void manager_wait(Manager *manager) {
+    struct timespec deadline = manager->start, wake;
+
+    timespec_add_ms(&deadline, manager->time_limit_ms);
+
+    while (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+        // A system that found the combining lock held by this thread left its events here
+        do {
+            pthread_mutex_lock(&manager->combine_lock);
+            manager_inline_pass(manager);
+            pthread_mutex_unlock(&manager->combine_lock);
+        } while (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed) && manager_pending(manager));
+
+        pthread_mutex_lock(&manager->wait_lock);
+        if (!atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+            // Stopped by a pass, nothing left to wait for
+        } else if (manager->stall_periods > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &wake);
+            timespec_add_ms(&wake, manager->stall_period_ms);
+            if (manager->time_limit_ms > 0 && timespec_elapsed_ns(&deadline, &wake) > 0) {
+                wake = deadline;
+            }
+            pthread_cond_timedwait(&manager->stopped, &manager->wait_lock, &wake);
+        } else if (manager->time_limit_ms > 0) {
+            pthread_cond_timedwait(&manager->stopped, &manager->wait_lock, &deadline);
+        } else {
+            pthread_cond_wait(&manager->stopped, &manager->wait_lock);
+        }
+        pthread_mutex_unlock(&manager->wait_lock);
+    }
+}
+
+/**
+ * Checks whether any events are waiting for the manager.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @return                 Non-zero if the queue or a channel has events.
+ */
+int manager_pending(Manager *manager) {
+    return event_queue_size(&manager->event_queue) > 0 ||
+           (manager->use_channels && event_channels_ready(&manager->channels));
 }
 
 
@@ -49,10 +186,48 @@ static void display_simulation_state(Manager *manager);
  * @param[out] manager  Pointer to the `Manager` to initialize.
  */
 void manager_init(Manager *manager) {
-    manager->simulation_running = 1; // Any non-zero value to state the sim is running
+    pthread_condattr_t condattr;
+
+    atomic_init(&manager->simulation_running, 1); // Any non-zero value to state the sim is running
     system_array_init(&manager->system_array);
     resource_array_init(&manager->resource_array);
     event_queue_init(&manager->event_queue);
+    manager->display = 1;
+    manager->time_limit_ms = 0;
+    manager->oxygen = NULL;
+    manager->distance = NULL;
+    manager->result.outcome = OUTCOME_RUNNING;
+    manager->result.elapsed_ms = 0;
+    manager->result.min_oxygen = 0;
+    manager->result.distance = 0;
+    manager->result.worker_faults = 0;
+    manager->result.worker_rss_kb = 0;
+    manager->result.events_shed = 0;
+    manager->result.event_backlog_peak = 0;
+    manager->result.watchdog_alerts = 0;
+    manager->monitor = NULL;
+    manager->monitor_context = NULL;
+    manager->policy_rules = policy_default(&manager->policy_rule_count);
+    memset(&manager->policy, 0, sizeof(PolicyTable));
+    manager->use_channels = 0;
+    memset(&manager->channels, 0, sizeof(EventChannelSet));
+    manager->inline_manager = 0;
+    pthread_mutex_init(&manager->combine_lock, NULL);
+    pthread_mutex_init(&manager->wait_lock, NULL);
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&manager->stopped, &condattr);
+    pthread_condattr_destroy(&condattr);
+    manager->stall_periods = STALL_PERIODS;
+    manager->stall_period_ms = SYSTEM_WAIT_TIME;
+    manager->stall_progress = -1;
+    manager->stall_since.tv_sec = 0;
+    manager->stall_since.tv_nsec = 0;
+    manager->watchdog = 1;
+    manager->trace = NULL;
+    manager->flight_on_depletion = 0;
+    atomic_init(&manager->heartbeat, 0);
+    atomic_init(&manager->activity, ACTIVITY_STARTING);
 }
 
 /**
@@ -69,79 +244,117 @@ void manager_clean(Manager *manager) {
     event_queue_clean(&manager->event_queue);
     resource_array_clean(&manager->resource_array);
     system_array_clean(&manager->system_array);
+    policy_clean(&manager->policy);
+    event_channels_clean(&manager->channels);
+    pthread_mutex_destroy(&manager->combine_lock);
+    pthread_mutex_destroy(&manager->wait_lock);
+    pthread_cond_destroy(&manager->stopped);
 
-    manager->simulation_running = 0;
+    atomic_store_explicit(&manager->simulation_running, 0, memory_order_relaxed);
+}
+
+/**
+ * Terminates every system and stops the simulation.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     outcome  The `OUTCOME_*` code to record for the run.
+ */
+void manager_terminate(Manager *manager, int outcome) {
+    for (int i = 0; i < manager->system_array.size; i++) {
+        atomic_store_explicit(&manager->system_array.systems[i]->status, TERMINATE, memory_order_relaxed);
+    }
+    manager->result.outcome = outcome;
+    atomic_store_explicit(&manager->simulation_running, 0, memory_order_relaxed);
+    flight_record(FLIGHT_TERMINATE, -1, outcome, 0, 0, 0);
 }
 
 /**
  * Runs the manager loop.
  *
  * Handles event processing, updates system statuses, and displays the simulation state.
- * Continues until the simulation is no longer running. (In a multi-threaded implementation)
+ * The pass's events are first collected into one decision per resource by the compiled
+ * policy, then the decisions are applied to the systems together. With per-system
+ * channels, their events are merged with the shared queue's, highest priority first.
+ * A run that ends with Oxygen depleted dumps the flight recorder if `flight_on_depletion` is set.
  *
- * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in,out] manager  Pointer to the `Manager`, prepared with `simulation_prepare`.
  */
 void manager_run(Manager *manager) {
     Event event;
-    int i, status;
-    int event_found_flag = 0, no_oxygen_flag = 0, distance_reached_flag = 0, need_more_flag = 0, need_less_flag = 0;
-    
-    System *sys = NULL;
+    Event *channel_events = NULL;
+    int channel_count = 0, next = 0, queued;
+    int terminated = 0;
 
     // Update the display of the current state of things
-    display_simulation_state(manager);
-
-    // Process events if one is popped
-    
-    event_found_flag = event_queue_pop(&manager->event_queue, &event);
-
-    while (event_found_flag) {
-        // Handle the event
-        printf("Event: [%s] Reported Resource [%s : %d] Status [%d]\n",
-                event.system->name,
-                event.resource->name,
-                event.amount,
-                event.status);
-
-        // Set some flags based on the event that we can react to below
-        no_oxygen_flag        = (event.status == STATUS_EMPTY && strcmp(event.resource->name, "Oxygen") == 0);
-        distance_reached_flag = (event.status == STATUS_CAPACITY && strcmp(event.resource->name, "Distance") == 0);
-        need_more_flag        = (event.status == STATUS_LOW || event.status == STATUS_EMPTY || event.status == STATUS_INSUFFICIENT);
-        need_less_flag        = (event.status == STATUS_CAPACITY);
-
-        if (no_oxygen_flag) {
-            printf("Oxygen depleted. Terminating all systems.\n");
-        }
+    if (manager->display) {
+        display_simulation_state(manager);
+    }
 
-        if (distance_reached_flag) {
-            printf("Destination reached. Terminating all systems.\n");
+    // Measure the backlog, which also tells the systems whether to shed LOW priority events
+    event_queue_measure(&manager->event_queue);
+
+    // Track the oxygen margin for the run's result
+    if (manager->oxygen != NULL && manager->oxygen->amount < manager->result.min_oxygen) {
+        manager->result.min_oxygen = manager->oxygen->amount;
+    }
+
+    if (manager->use_channels) {
+        channel_count = event_channels_drain(&manager->channels, &channel_events);
+    }
+
+    // Collect every waiting event, taking from whichever source has the higher priority next
+    queued = event_queue_pop(&manager->event_queue, &event);
+    while (queued || next < channel_count) {
+        Event *current = &event;
+
+        if (next < channel_count && (!queued || channel_events[next].priority > event.priority)) {
+            current = &channel_events[next++];
         }
 
-        if (no_oxygen_flag || distance_reached_flag) {
-            printf("Terminated");
-            status = TERMINATE;
-            manager->simulation_running = 0;
+        if (manager->display && current->system != NULL) {
+            printf("Event: [%s] Reported Resource [%s : %d] Status [%d]\n",
+                    current->system->name,
+                    current->resource->name,
+                    current->amount,
+                    current->status);
+        } else if (manager->display) {
+            printf("Event: Resource [%s : %d] %s -> %s\n",
+                    current->resource->name,
+                    current->amount,
+                    resource_level_name(current->from_level),
+                    resource_level_name(current->to_level));
         }
-        else if (need_more_flag) {
-            status = FAST;
+
+        flight_record_event(FLIGHT_HANDLED, current);
+        if (manager->trace != NULL) {
+            trace_event(manager->trace, current);
         }
-        else if (need_less_flag) {
-            status = SLOW;
+        if (policy_collect(manager, current) == ACTION_TERMINATE) {
+            terminated = atomic_load_explicit(&manager->simulation_running, memory_order_relaxed);
         }
 
-        if (no_oxygen_flag || distance_reached_flag || need_more_flag || need_less_flag) {
-            // Update all of the systems to speed up or slow down production, or terminate
-            for (i = 0; i < manager->system_array.size; i++) {
-                sys = manager->system_array.systems[i];
-                if (status == TERMINATE || sys->produced.resource == event.resource) {
-                    sys->status = status;
-                }
-            }   
+        if (current == &event) {
+            queued = event_queue_pop(&manager->event_queue, &event);
         }
+    }
+
+    // Then update the systems once for the whole pass
+    policy_apply(manager);
+
+    // Keep what every thread was doing when the crew ran out of air
+    if (terminated && manager->result.outcome == OUTCOME_NO_OXYGEN && manager->flight_on_depletion) {
+        flight_recorder_dump(FLIGHT_REASON_OXYGEN, 0);
+    }
 
-        event_found_flag = event_queue_pop(&manager->event_queue, &event);
+    if (terminated && manager->display) {
+        if (manager->result.outcome == OUTCOME_NO_OXYGEN) {
+            printf("Oxygen depleted. Terminating all systems.\n");
+        }
+        else if (manager->result.outcome == OUTCOME_DESTINATION) {
+            printf("Destination reached. Terminating all systems.\n");
+        }
+        printf("Terminated");
     }
-    
 }
 
 // Don't worry much about these! These are special codes that allow us to do some formatting in the terminal
@@ -207,7 +420,7 @@ void display_simulation_state(Manager *manager) {
 
         // Map system status code to a human-readable string
         const char *status_str;
-        switch (system->status) {
+        switch (atomic_load_explicit(&system->status, memory_order_relaxed)) {
             case TERMINATE:
                 status_str = "TERMINATE";
                 break;
@@ -228,7 +441,13 @@ void display_simulation_state(Manager *manager) {
                 break;
         }
 
-        printf(ANSI_LN_CLR  "%-20s: %-10s\n", system->name, status_str);
+        printf(ANSI_LN_CLR  "%-20s: %-10s cpu %7.1f ms  sleep %8.1f ms  wait %8.1f ms  lock %6.1f ms  rate %3.0f%%\n",
+               system->name, status_str,
+               atomic_load_explicit(&system->cpu_ns, memory_order_relaxed) / 1e6,
+               atomic_load_explicit(&system->sleep_ns, memory_order_relaxed) / 1e6,
+               atomic_load_explicit(&system->starved_ns, memory_order_relaxed) / 1e6,
+               atomic_load_explicit(&system->blocked_ns, memory_order_relaxed) / 1e6,
+               system_rate(system) * 100);
     }
 
     printf(ANSI_LN_CLR  "\n");
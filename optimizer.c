@@ -0,0 +1,326 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// One dimension of the configuration space being searched
+typedef struct OptimizerParameter {
+    char label[64];
+    Resource *resource;     // Set when the parameter is a resource's initial amount
+    int *value;             // Set for every other parameter, points into the loaded scenario
+    int base;
+    int low;
+    int high;
+} OptimizerParameter;
+
+// State shared by every worker through a shared mapping, so one candidate's result can prune the others
+typedef struct OptimizerShared {
+    atomic_llong best_time_ms;  // Fastest time to destination so far, zero until one arrives
+} OptimizerShared;
+
+// What each worker's monitor tracks about its own run; each forked worker has its own copy
+typedef struct OptimizerWatch {
+    int initial_oxygen;
+    int initial_distance;
+} OptimizerWatch;
+
+// Everything a generation of workers needs
+typedef struct Optimizer {
+    OptimizerParameter *parameters;
+    int parameter_count;
+    int *candidates;            // `parameter_count` values per candidate, for every candidate in the search
+    int first;                  // Index of the generation's first candidate
+    int destination;
+    OptimizerShared *shared;
+    OptimizerWatch watch;
+} Optimizer;
+
+static void optimizer_add(Optimizer *optimizer, const char *owner, const char *field, Resource *resource, int *value, int low, int high);
+static void optimizer_setup(Manager *manager, int variant, void *context);
+static int optimizer_monitor(Manager *manager, void *context);
+static double optimizer_score(const Optimizer *optimizer, const RunResult *result);
+static int random_between(unsigned int *seed, int low, int high);
+
+/**
+ * Searches the configuration space for the fastest safe trip to the destination.
+ *
+ * Candidates vary the initial amount and capacity of every resource (except Distance,
+ * which defines the destination) and every system's processing time. They run
+ * concurrently in generations of `jobs`. The first generation samples the whole space;
+ * later ones mutate the best candidates found so far, so the search concentrates on
+ * promising regions.
+ *
+ * Each candidate is watched while it runs and stopped as soon as it cannot win: when
+ * its oxygen runway at the current drain rate is shorter than the time it needs to cover
+ * the remaining distance, or when it has fallen well behind the best candidate so far.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`; its time limit applies to each candidate.
+ * @param[in]     budget   Total number of candidates to run.
+ * @param[in]     jobs     Candidates running at once, also the size of each generation.
+ * @param[in]     seed     Seed for the search, the same seed gives the same candidates.
+ */
+void optimizer_run(Manager *manager, int budget, int jobs, unsigned int seed) {
+    Optimizer optimizer;
+    RunResult *results;
+    double *scores;
+    int *ranking;
+    int capacity, done = 0, pruned = 0, arrived = 0;
+    long long simulated_ms = 0;
+
+    if (budget <= 0) {
+        return;
+    }
+    if (jobs <= 0) {
+        jobs = 1;
+    }
+
+    manager->display = 0;
+    simulation_prepare(manager);
+    if (manager->oxygen == NULL || manager->distance == NULL) {
+        fprintf(stderr, "The scenario needs Oxygen and Distance resources to optimize.\n");
+        return;
+    }
+
+    capacity = 2 * manager->resource_array.size + manager->system_array.size;
+    optimizer.parameters = (OptimizerParameter *)malloc(capacity * sizeof(OptimizerParameter));
+    optimizer.parameter_count = 0;
+    if (optimizer.parameters == NULL) {
+        fprintf(stderr, "Failed to allocate memory for Optimizer parameters.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        Resource *resource = manager->resource_array.resources[i];
+        if (resource == manager->distance) {
+            continue;
+        }
+        optimizer_add(&optimizer, resource->name, "max_capacity", NULL, &resource->max_capacity,
+                      resource->max_capacity / 2, resource->max_capacity * 2);
+        optimizer_add(&optimizer, resource->name, "amount", resource, NULL, 0, resource->max_capacity * 2);
+    }
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        optimizer_add(&optimizer, system->name, "processing_time", NULL, &system->processing_time,
+                      (system->processing_time + 1) / 2, system->processing_time * 2);
+    }
+
+    optimizer.candidates = (int *)malloc(budget * optimizer.parameter_count * sizeof(int));
+    results = (RunResult *)malloc(budget * sizeof(RunResult));
+    scores = (double *)malloc(budget * sizeof(double));
+    ranking = (int *)malloc(budget * sizeof(int));
+    optimizer.shared = (OptimizerShared *)mmap(NULL, sizeof(OptimizerShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (optimizer.candidates == NULL || results == NULL || scores == NULL || ranking == NULL || optimizer.shared == MAP_FAILED) {
+        fprintf(stderr, "Failed to allocate memory for Optimizer.\n");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&optimizer.shared->best_time_ms, 0);
+    optimizer.destination = manager->distance->max_capacity;
+
+    printf("Searching %d parameters with %d candidates, %d at a time...\n", optimizer.parameter_count, budget, jobs);
+
+    while (done < budget) {
+        int generation = (budget - done < jobs) ? budget - done : jobs;
+
+        for (int c = done; c < done + generation; c++) {
+            int *candidate = &optimizer.candidates[c * optimizer.parameter_count];
+            // Breed from a random elite candidate once any candidate has made progress
+            int parent = (done > 0 && scores[ranking[0]] < INFINITY)
+                       ? ranking[rand_r(&seed) % (done < OPTIMIZER_ELITE ? done : OPTIMIZER_ELITE)] : -1;
+
+            for (int p = 0; p < optimizer.parameter_count; p++) {
+                OptimizerParameter *parameter = &optimizer.parameters[p];
+                if (c == 0) {
+                    candidate[p] = parameter->base;
+                } else if (parent < 0) {
+                    candidate[p] = random_between(&seed, parameter->low, parameter->high);
+                } else {
+                    // Nudge about half of the parent's parameters by up to a tenth of their range
+                    int value = optimizer.candidates[parent * optimizer.parameter_count + p];
+                    int step = (parameter->high - parameter->low) / 10 + 1;
+                    if (rand_r(&seed) % 2 == 0) {
+                        value += random_between(&seed, -step, step);
+                    }
+                    candidate[p] = (value < parameter->low) ? parameter->low : (value > parameter->high) ? parameter->high : value;
+                }
+            }
+        }
+
+        optimizer.first = done;
+        runner_run_variants(manager, generation, jobs, optimizer_setup, &optimizer, &results[done]);
+
+        // Rank every candidate so far, insertion sort keeps it simple for the sizes involved
+        for (int c = done; c < done + generation; c++) {
+            int position = c;
+            scores[c] = optimizer_score(&optimizer, &results[c]);
+            while (position > 0 && scores[ranking[position - 1]] > scores[c]) {
+                ranking[position] = ranking[position - 1];
+                position--;
+            }
+            ranking[position] = c;
+            simulated_ms += results[c].elapsed_ms;
+            pruned += (results[c].outcome == OUTCOME_PRUNED);
+            arrived += (results[c].outcome == OUTCOME_DESTINATION);
+        }
+        done += generation;
+
+        printf("%d/%d candidates run, best %.0f ms\n", done, budget, scores[ranking[0]]);
+    }
+
+    printf("%d reached the destination, %d pruned early, %lld ms simulated in total\n", arrived, pruned, simulated_ms);
+    for (int r = 0; r < budget && r < 3; r++) {
+        int c = ranking[r];
+        printf("#%d: %s, %.0f ms%s, oxygen margin %d\n", r + 1, outcome_name(results[c].outcome), scores[c],
+               results[c].outcome == OUTCOME_DESTINATION ? "" : " (projected)", results[c].min_oxygen);
+        for (int p = 0; p < optimizer.parameter_count; p++) {
+            printf("    %-32s %8d (base %d)\n", optimizer.parameters[p].label,
+                   optimizer.candidates[c * optimizer.parameter_count + p], optimizer.parameters[p].base);
+        }
+    }
+
+    munmap(optimizer.shared, sizeof(OptimizerShared));
+    free(ranking);
+    free(scores);
+    free(results);
+    free(optimizer.candidates);
+    free(optimizer.parameters);
+}
+
+/**
+ * Adds a dimension to the search.
+ *
+ * @param[in,out] optimizer  Pointer to the `Optimizer`.
+ * @param[in]     owner      Name of the system or resource the parameter belongs to.
+ * @param[in]     field      Name of the parameter.
+ * @param[in]     resource   The resource whose initial amount this is, or NULL.
+ * @param[in]     value      Pointer to the parameter when `resource` is NULL.
+ * @param[in]     low        Smallest value to try.
+ * @param[in]     high       Largest value to try.
+ */
+static void optimizer_add(Optimizer *optimizer, const char *owner, const char *field, Resource *resource, int *value, int low, int high) {
+    OptimizerParameter *parameter = &optimizer->parameters[optimizer->parameter_count++];
+
+    snprintf(parameter->label, sizeof(parameter->label), "%s %s", owner, field);
+    parameter->resource = resource;
+    parameter->value = value;
+    parameter->base = (resource != NULL) ? atomic_load(&resource->amount) : *value;
+    parameter->low = low;
+    parameter->high = (high > low) ? high : low + 1;
+}
+
+/**
+ * `VariantSetup` for the search, applies a candidate's parameters in its forked worker.
+ *
+ * Capacities are applied before initial amounts so amounts can be clamped to them.
+ *
+ * @param[in,out] manager  Pointer to the worker's copy of the `Manager`.
+ * @param[in]     variant  Index of the candidate within its generation.
+ * @param[in]     context  Pointer to the `Optimizer`.
+ */
+static void optimizer_setup(Manager *manager, int variant, void *context) {
+    Optimizer *optimizer = (Optimizer *)context;
+    int *candidate = &optimizer->candidates[(optimizer->first + variant) * optimizer->parameter_count];
+
+    for (int p = 0; p < optimizer->parameter_count; p++) {
+        if (optimizer->parameters[p].resource == NULL) {
+            *optimizer->parameters[p].value = candidate[p];
+        }
+    }
+    for (int p = 0; p < optimizer->parameter_count; p++) {
+        Resource *resource = optimizer->parameters[p].resource;
+        if (resource != NULL) {
+            atomic_store(&resource->amount, (candidate[p] < resource->max_capacity) ? candidate[p] : resource->max_capacity);
+        }
+    }
+
+    optimizer->watch.initial_oxygen = atomic_load(&manager->oxygen->amount);
+    optimizer->watch.initial_distance = atomic_load(&manager->distance->amount);
+    manager->monitor = optimizer_monitor;
+    manager->monitor_context = optimizer;
+}
+
+/**
+ * `RunMonitor` for candidates, stops a candidate as soon as it cannot win.
+ *
+ * @param[in] manager  Pointer to the worker's `Manager`.
+ * @param[in] context  Pointer to the worker's copy of the `Optimizer`.
+ * @return             `OUTCOME_PRUNED` to stop the candidate, otherwise `OUTCOME_RUNNING`.
+ */
+static int optimizer_monitor(Manager *manager, void *context) {
+    Optimizer *optimizer = (Optimizer *)context;
+    struct timespec now;
+    long long elapsed, best, candidate_best;
+    double oxygen_rate, distance_rate, remaining_ms, runway_ms;
+    int oxygen, distance;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = timespec_elapsed_ns(&manager->start, &now) / 1000000LL;
+
+    // Publish an arrival so other candidates can be judged against it
+    if (manager->result.outcome == OUTCOME_DESTINATION) {
+        best = atomic_load(&optimizer->shared->best_time_ms);
+        while ((best == 0 || elapsed < best)
+               && !atomic_compare_exchange_weak(&optimizer->shared->best_time_ms, &best, elapsed)) {
+            // Another worker updated the best time, try again against it
+        }
+        return OUTCOME_RUNNING;
+    }
+
+    if (elapsed < OPTIMIZER_OBSERVE_MS) {
+        return OUTCOME_RUNNING;
+    }
+
+    oxygen = atomic_load(&manager->oxygen->amount);
+    distance = atomic_load(&manager->distance->amount);
+    oxygen_rate = (double)(oxygen - optimizer->watch.initial_oxygen) / elapsed;
+    distance_rate = (double)(distance - optimizer->watch.initial_distance) / elapsed;
+    remaining_ms = (distance_rate > 0) ? (optimizer->destination - distance) / distance_rate : INFINITY;
+
+    // Doomed: oxygen will run out before the destination at the current rates
+    if (oxygen_rate < 0) {
+        runway_ms = oxygen / -oxygen_rate;
+        if (runway_ms < remaining_ms) {
+            return OUTCOME_PRUNED;
+        }
+    }
+
+    // Dominated: already well behind the best candidate so far
+    best = atomic_load(&optimizer->shared->best_time_ms);
+    candidate_best = elapsed + (long long)fmin(remaining_ms, 1e15);
+    if (best > 0 && (elapsed > best || candidate_best > best * OPTIMIZER_SLACK)) {
+        return OUTCOME_PRUNED;
+    }
+
+    return OUTCOME_RUNNING;
+}
+
+/**
+ * Scores a candidate, lower is better.
+ *
+ * @param[in] optimizer  Pointer to the `Optimizer`.
+ * @param[in] result     Result of the candidate.
+ * @return               Time to destination (projected for runs stopped at the time limit), or infinity.
+ */
+static double optimizer_score(const Optimizer *optimizer, const RunResult *result) {
+    double time;
+
+    if (result->outcome != OUTCOME_DESTINATION && result->outcome != OUTCOME_TIME_LIMIT) {
+        return INFINITY;
+    }
+    time = run_time_to_destination(result, 0, optimizer->destination);
+    return (time > 0) ? time : INFINITY;
+}
+
+/**
+ * Picks a uniformly distributed integer.
+ *
+ * @param[in,out] seed  State for `rand_r`.
+ * @param[in]     low   Smallest value.
+ * @param[in]     high  Largest value.
+ * @return              A value in [`low`, `high`].
+ */
+static int random_between(unsigned int *seed, int low, int high) {
+    return low + (int)(rand_r(seed) % (unsigned int)(high - low + 1));
+}
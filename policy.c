@@ -0,0 +1,209 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Manager policies: how the manager reacts to each event */
+
+// A policy is a list of rules (resource role, status) -> action. Before a run the rules are
+// compiled into a table with one entry per (resource, status). Each manager tick, every event
+// costs one lookup that records a decision for its resource; conflicting decisions for the
+// same resource are resolved there, and the surviving decisions are applied in one pass over
+// the systems at the end of the tick.
+
+static const PolicyRule policy_default_rules[] = {
+    {RESOURCE_ROLE_ANY,         STATUS_LOW,          ACTION_SPEED_UP,  OUTCOME_RUNNING},
+    {RESOURCE_ROLE_ANY,         STATUS_EMPTY,        ACTION_SPEED_UP,  OUTCOME_RUNNING},
+    {RESOURCE_ROLE_ANY,         STATUS_INSUFFICIENT, ACTION_SPEED_UP,  OUTCOME_RUNNING},
+    {RESOURCE_ROLE_ANY,         STATUS_CAPACITY,     ACTION_SLOW_DOWN, OUTCOME_RUNNING},
+    {RESOURCE_ROLE_LIFE,        STATUS_EMPTY,        ACTION_TERMINATE, OUTCOME_NO_OXYGEN},
+    {RESOURCE_ROLE_DESTINATION, STATUS_CAPACITY,     ACTION_TERMINATE, OUTCOME_DESTINATION},
+};
+
+static int policy_decision(const PolicyTable *table, const Resource *resource);
+
+/**
+ * The policy every `Manager` starts with.
+ *
+ * Producers speed up when their resource runs low, empty or short and slow down when it
+ * is full. Running out of a `RESOURCE_ROLE_LIFE` resource or filling the
+ * `RESOURCE_ROLE_DESTINATION` resource ends the run.
+ *
+ * @param[out] count  Receives the number of rules.
+ * @return            The rules.
+ */
+const PolicyRule *policy_default(int *count) {
+    *count = (int)(sizeof(policy_default_rules) / sizeof(policy_default_rules[0]));
+    return policy_default_rules;
+}
+
+/**
+ * Compiles policy rules into a dispatch table for the scenario loaded into `manager`.
+ *
+ * For each resource and status the last rule naming the resource's role wins; rules for
+ * `RESOURCE_ROLE_ANY` only apply where no rule names the role. Any table compiled before
+ * is freed first, so this can be called again after the scenario changes.
+ *
+ * @param[in,out] table    Pointer to the `PolicyTable`, zeroed or compiled before.
+ * @param[in]     manager  Pointer to the loaded `Manager`.
+ * @param[in]     rules    The rules.
+ * @param[in]     count    Number of rules.
+ */
+void policy_compile(PolicyTable *table, Manager *manager, const PolicyRule *rules, int count) {
+    int resources = manager->resource_array.size;
+
+    policy_clean(table);
+    table->resource_count = resources;
+    table->entries = (PolicyEntry *)malloc((resources > 0 ? resources : 1) * POLICY_STATUS_COUNT * sizeof(PolicyEntry));
+    table->decisions = (PolicyDecision *)malloc((resources > 0 ? resources : 1) * sizeof(PolicyDecision));
+    if (table->entries == NULL || table->decisions == NULL) {
+        fprintf(stderr, "Failed to allocate memory for PolicyTable.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int r = 0; r < resources; r++) {
+        int role = manager->resource_array.resources[r]->role;
+
+        for (int status = 0; status < POLICY_STATUS_COUNT; status++) {
+            PolicyEntry *entry = &table->entries[r * POLICY_STATUS_COUNT + status];
+            int matched_role = 0;
+
+            entry->action = ACTION_NONE;
+            entry->outcome = OUTCOME_RUNNING;
+            for (int i = 0; i < count; i++) {
+                int specific = (rules[i].role == role);
+
+                if (rules[i].status != status || (!specific && rules[i].role != RESOURCE_ROLE_ANY) || (matched_role && !specific)) {
+                    continue;
+                }
+                entry->action = rules[i].action;
+                entry->outcome = rules[i].outcome;
+                matched_role |= specific;
+            }
+        }
+        table->decisions[r].action = ACTION_NONE;
+        table->decisions[r].priority = 0;
+    }
+    table->pending_count = 0;
+    table->terminate_outcome = OUTCOME_RUNNING;
+}
+
+/**
+ * Frees the memory used by a `PolicyTable`, leaving it empty.
+ *
+ * @param[in,out] table  Pointer to the `PolicyTable`.
+ */
+void policy_clean(PolicyTable *table) {
+    free(table->entries);
+    free(table->decisions);
+    memset(table, 0, sizeof(PolicyTable));
+}
+
+/**
+ * Records the decision the compiled policy gives for one event, to be applied by `policy_apply`.
+ *
+ * Each resource keeps one decision per tick: a later event replaces it only if its priority
+ * is at least as high. The queue hands events out highest priority first and in arrival
+ * order within a priority, so the most urgent and then most recent report wins (a consumer
+ * starving for a resource outranks the resource filling up). A terminate outranks every
+ * other decision, and the first one collected sets the outcome.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`, with its policy compiled.
+ * @param[in]     event    The event.
+ * @return                 The `ACTION_*` the policy gives for the event.
+ */
+int policy_collect(Manager *manager, const Event *event) {
+    PolicyTable *table = &manager->policy;
+    const PolicyEntry *entry;
+    PolicyDecision *decision;
+    int id;
+
+    if (event->resource == NULL || event->status < 0 || event->status >= POLICY_STATUS_COUNT) {
+        return ACTION_NONE;
+    }
+    id = event->resource->id;
+    if (id < 0 || id >= table->resource_count) {
+        return ACTION_NONE;
+    }
+
+    entry = &table->entries[id * POLICY_STATUS_COUNT + event->status];
+    if (entry->action == ACTION_NONE) {
+        return ACTION_NONE;
+    }
+    if (entry->action == ACTION_TERMINATE) {
+        if (table->terminate_outcome == OUTCOME_RUNNING) {
+            table->terminate_outcome = entry->outcome;
+        }
+        return ACTION_TERMINATE;
+    }
+
+    decision = &table->decisions[id];
+    if (decision->action == ACTION_NONE) {
+        table->pending_count++;
+    } else if (event->priority < decision->priority) {
+        return entry->action;
+    }
+    decision->action = entry->action;
+    decision->priority = event->priority;
+    return entry->action;
+}
+
+/**
+ * Applies the decisions collected this tick and clears them.
+ *
+ * Every system is visited once. A decision about the resource it produces takes precedence
+ * over one about the resource it consumes. Once the run has been stopped nothing overrides
+ * `TERMINATE`.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`, with its policy compiled.
+ */
+void policy_apply(Manager *manager) {
+    PolicyTable *table = &manager->policy;
+
+    if (table->terminate_outcome != OUTCOME_RUNNING) {
+        if (atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+            manager_terminate(manager, table->terminate_outcome);
+        }
+    } else if (table->pending_count > 0 && atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+        for (int i = 0; i < manager->system_array.size; i++) {
+            System *system = manager->system_array.systems[i];
+            int produced = policy_decision(table, system->produced.resource);
+            int current = atomic_load_explicit(&system->status, memory_order_relaxed);
+            int status = current;
+
+            if (produced == ACTION_SPEED_UP) {
+                status = FAST;
+            } else if (produced == ACTION_SLOW_DOWN) {
+                status = SLOW;
+            } else if (policy_decision(table, system->consumed.resource) == ACTION_THROTTLE) {
+                status = SLOW;
+            }
+            if (status != current) {
+                flight_record(FLIGHT_STATUS, system->id, current, status, 0, 0);
+                atomic_store_explicit(&system->status, status, memory_order_relaxed);
+            }
+        }
+    }
+
+    if (table->pending_count > 0) {
+        for (int r = 0; r < table->resource_count; r++) {
+            table->decisions[r].action = ACTION_NONE;
+        }
+    }
+    table->pending_count = 0;
+    table->terminate_outcome = OUTCOME_RUNNING;
+}
+
+/**
+ * Looks up the decision collected this tick for a resource.
+ *
+ * @param[in] table     Pointer to the `PolicyTable`.
+ * @param[in] resource  The resource, may be NULL.
+ * @return              The `ACTION_*` decided, `ACTION_NONE` if there is none.
+ */
+static int policy_decision(const PolicyTable *table, const Resource *resource) {
+    if (resource == NULL || resource->id < 0 || resource->id >= table->resource_count) {
+        return ACTION_NONE;
+    }
+    return table->decisions[resource->id].action;
+}
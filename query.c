@@ -0,0 +1,595 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Query tool for recordings written with `simulation --record` and traces written with
+// `simulation --trace`. The recording is memory-mapped and only the blocks a query needs
+// are decoded, using each block's time range and per-column min/max/sum to skip the rest.
+// A trace has no index; it is read in chunks and decoded record by record as it streams.
+//
+// Usage:
+//   ./query FILE levels NAME T0 T1            Every sample of NAME between T0 and T1 (ms)
+//   ./query FILE window NAME T0 T1 WIDTH      Min/max/mean of NAME for each WIDTH ms window
+//   ./query FILE cross NAME below|above LEVEL First time NAME was at or below/above LEVEL
+//   ./query FILE trace [NAME]                 Every traced event, or those of system or resource NAME
+
+// Where one block sits in the mapped file
+typedef struct QueryBlock {
+    const RecordingBlockHeader *header;
+    const RecordingColumnSummary *summaries;
+    const unsigned char *payload;
+} QueryBlock;
+
+// A memory-mapped recording and the index of its blocks
+typedef struct Recording {
+    const unsigned char *data;
+    size_t size;
+    const RecordingHeader *header;
+    char **names;           // Resource names followed by system names
+    int name_count;
+    QueryBlock *blocks;
+    int block_count;
+} Recording;
+
+// Accumulates the statistics of one window
+typedef struct WindowStats {
+    int min;
+    int max;
+    long long sum;
+    long long count;
+} WindowStats;
+
+static void recording_open(Recording *recording, const char *path);
+static void recording_close(Recording *recording);
+static size_t recording_block_size(const Recording *recording, const unsigned char *block, const unsigned char *end);
+static int recording_find_column(const Recording *recording, const char *name);
+static int block_decode(const QueryBlock *block, int column, long long *times, int *values);
+static void window_add(WindowStats *stats, int min, int max, long long sum, long long count);
+static void window_print(long long start, long long width, const WindowStats *stats);
+static void query_levels(const Recording *recording, int column, long long t0, long long t1);
+static void query_window(const Recording *recording, int column, long long t0, long long t1, long long width);
+static void query_cross(const Recording *recording, int column, int below, int level);
+static int query_trace(const char *path, const char *name);
+static int trace_read_names(int fd, const TraceHeader *header, char **names);
+static void usage(const char *program);
+
+int main(int argc, char *argv[]) {
+    Recording recording;
+    int column;
+
+    if (argc >= 3 && argc <= 4 && strcmp(argv[2], "trace") == 0) {
+        return query_trace(argv[1], (argc == 4) ? argv[3] : NULL);
+    }
+    if (argc < 4) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    recording_open(&recording, argv[1]);
+    column = recording_find_column(&recording, argv[3]);
+    if (column < 0) {
+        fprintf(stderr, "No resource or system named \"%s\" in %s.\n", argv[3], argv[1]);
+        recording_close(&recording);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[2], "levels") == 0 && argc == 6) {
+        query_levels(&recording, column, atoll(argv[4]), atoll(argv[5]));
+    } else if (strcmp(argv[2], "window") == 0 && argc == 7 && atoll(argv[6]) > 0) {
+        query_window(&recording, column, atoll(argv[4]), atoll(argv[5]), atoll(argv[6]));
+    } else if (strcmp(argv[2], "cross") == 0 && argc == 6
+               && (strcmp(argv[4], "below") == 0 || strcmp(argv[4], "above") == 0)) {
+        query_cross(&recording, column, strcmp(argv[4], "below") == 0, atoi(argv[5]));
+    } else {
+        usage(argv[0]);
+        recording_close(&recording);
+        return EXIT_FAILURE;
+    }
+
+    recording_close(&recording);
+    return 0;
+}
+
+/**
+ * Memory-maps a recording and indexes its blocks.
+ *
+ * Only the fixed-size block headers are read, so indexing a long recording touches
+ * a tiny fraction of the file.
+ *
+ * @param[out] recording  Pointer to the `Recording` to fill.
+ * @param[in]  path       Path of the recording file.
+ */
+static void recording_open(Recording *recording, const char *path) {
+    struct stat st;
+    const unsigned char *cursor, *end;
+    uint16_t length;
+    int fd, capacity;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror("Failed to open recording");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < sizeof(RecordingHeader)) {
+        fprintf(stderr, "%s is too short to be a recording.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    recording->size = (size_t)st.st_size;
+    recording->data = (const unsigned char *)mmap(NULL, recording->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (recording->data == MAP_FAILED) {
+        perror("Failed to map recording");
+        exit(EXIT_FAILURE);
+    }
+
+    recording->header = (const RecordingHeader *)recording->data;
+    if (recording->header->magic != RECORDING_MAGIC || recording->header->version != RECORDING_VERSION ||
+        recording->header->block_samples == 0 || recording->header->block_samples > RECORDING_MAX_BLOCK_SAMPLES) {
+        fprintf(stderr, "%s is not a recording this tool can read.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    cursor = recording->data + sizeof(RecordingHeader);
+    end = recording->data + recording->size;
+
+    // Names of every resource (each followed by its capacity) and then every system,
+    // each at least its length, so a count the file cannot hold is cut short
+    if ((uint64_t)recording->header->resource_count + recording->header->system_count >
+        (uint64_t)(end - cursor) / sizeof(length)) {
+        fprintf(stderr, "%s is cut short in its header.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    recording->name_count = (int)(recording->header->resource_count + recording->header->system_count);
+    recording->names = (char **)malloc(recording->name_count * sizeof(char *));
+    if (recording->names == NULL) {
+        fprintf(stderr, "Failed to allocate memory for Recording names.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < recording->name_count; i++) {
+        size_t extra = (i < (int)recording->header->resource_count) ? sizeof(int32_t) : 0;
+
+        if ((size_t)(end - cursor) < sizeof(length)) {
+            fprintf(stderr, "%s is cut short in its header.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&length, cursor, sizeof(length));
+        cursor += sizeof(length);
+        if ((size_t)(end - cursor) < length + extra) {
+            fprintf(stderr, "%s is cut short in its header.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        recording->names[i] = (char *)malloc(length + 1);
+        if (recording->names[i] == NULL) {
+            fprintf(stderr, "Failed to allocate memory for Recording name.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(recording->names[i], cursor, length);
+        recording->names[i][length] = '\0';
+        cursor += length + extra;
+    }
+
+    // Count the blocks, then index them. A block cut short by a crash, or anything
+    // after a block that does not make sense, is ignored.
+    recording->block_count = 0;
+    recording->blocks = NULL;
+    for (int pass = 0; pass < 2; pass++) {
+        const unsigned char *block = cursor;
+        int count = 0;
+
+        while (block < end) {
+            const RecordingBlockHeader *header = (const RecordingBlockHeader *)block;
+            size_t block_size = recording_block_size(recording, block, end);
+
+            if (block_size == 0) {
+                break;
+            }
+            if (pass == 1) {
+                recording->blocks[count].header = header;
+                recording->blocks[count].summaries = (const RecordingColumnSummary *)(block + sizeof(RecordingBlockHeader));
+                recording->blocks[count].payload = block + block_size - header->payload_size;
+            }
+            count++;
+            block += block_size;
+        }
+
+        if (pass == 0) {
+            capacity = (count > 0) ? count : 1;
+            recording->blocks = (QueryBlock *)malloc(capacity * sizeof(QueryBlock));
+            if (recording->blocks == NULL) {
+                fprintf(stderr, "Failed to allocate memory for Recording blocks.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        recording->block_count = count;
+    }
+}
+
+/**
+ * Checks that a block lies within the file and agrees with the recording's header.
+ *
+ * The block must hold a summary for every column and no more samples than the header's
+ * `block_samples`, and every column must lie within its payload.
+ *
+ * @param[in] recording  Pointer to the `Recording`, with its header and names read.
+ * @param[in] block      Start of the block.
+ * @param[in] end        End of the file.
+ * @return               Size of the block in bytes, or 0 if it is cut short or damaged.
+ */
+static size_t recording_block_size(const Recording *recording, const unsigned char *block, const unsigned char *end) {
+    const RecordingBlockHeader *header = (const RecordingBlockHeader *)block;
+    const RecordingColumnSummary *summaries = (const RecordingColumnSummary *)(block + sizeof(RecordingBlockHeader));
+    size_t available = (size_t)(end - block);
+    size_t block_size;
+
+    if (available < sizeof(RecordingBlockHeader) || header->magic != RECORDING_BLOCK_MAGIC ||
+        header->column_count != (uint32_t)recording->name_count + 1 ||
+        header->sample_count > recording->header->block_samples) {
+        return 0;
+    }
+
+    block_size = sizeof(RecordingBlockHeader) + header->column_count * sizeof(RecordingColumnSummary) + header->payload_size;
+    if (block_size > available) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < header->column_count; i++) {
+        if ((uint64_t)summaries[i].offset + summaries[i].size > header->payload_size) {
+            return 0;
+        }
+    }
+    return block_size;
+}
+
+/**
+ * Unmaps a recording and frees its index.
+ *
+ * @param[in,out] recording  Pointer to the `Recording` to close.
+ */
+static void recording_close(Recording *recording) {
+    for (int i = 0; i < recording->name_count; i++) {
+        free(recording->names[i]);
+    }
+    free(recording->names);
+    free(recording->blocks);
+    munmap((void *)recording->data, recording->size);
+}
+
+/**
+ * Finds the column holding a resource amount or system status.
+ *
+ * @param[in] recording  Pointer to the `Recording`.
+ * @param[in] name       Name of the resource or system.
+ * @return               Column index within a block (the time column is 0), or -1 if not found.
+ */
+static int recording_find_column(const Recording *recording, const char *name) {
+    for (int i = 0; i < recording->name_count; i++) {
+        if (strcmp(recording->names[i], name) == 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Decodes the times and one column of a block.
+ *
+ * @param[in]  block   Pointer to the `QueryBlock`.
+ * @param[in]  column  Column to decode.
+ * @param[out] times   Receives `sample_count` times in milliseconds.
+ * @param[out] values  Receives `sample_count` values.
+ * @return             Number of samples decoded.
+ */
+static int block_decode(const QueryBlock *block, int column, long long *times, int *values) {
+    const unsigned char *time_data, *time_end, *value_data, *value_end;
+    int count = (int)block->header->sample_count;
+    int last_time = 0, last_value = 0, decoded = 0, length;
+    uint32_t raw;
+
+    if (column < 0 || column >= (int)block->header->column_count) {
+        return 0;
+    }
+    time_data = block->payload + block->summaries[0].offset;
+    time_end = time_data + block->summaries[0].size;
+    value_data = block->payload + block->summaries[column].offset;
+    value_end = value_data + block->summaries[column].size;
+
+    for (int i = 0; i < count; i++) {
+        length = varint_decode(time_data, time_end, &raw);
+        if (length == 0) {
+            break;
+        }
+        time_data += length;
+        last_time += zigzag_decode(raw);
+
+        length = varint_decode(value_data, value_end, &raw);
+        if (length == 0) {
+            break;
+        }
+        value_data += length;
+        last_value += zigzag_decode(raw);
+
+        times[i] = block->header->first_time_ms + last_time;
+        values[i] = last_value;
+        decoded++;
+    }
+
+    return decoded;
+}
+
+/**
+ * Adds samples to a window's statistics.
+ *
+ * @param[in,out] stats  Pointer to the `WindowStats`.
+ * @param[in]     min    Smallest value added.
+ * @param[in]     max    Largest value added.
+ * @param[in]     sum    Sum of the values added.
+ * @param[in]     count  Number of values added.
+ */
+static void window_add(WindowStats *stats, int min, int max, long long sum, long long count) {
+    if (stats->count == 0 || min < stats->min) {
+        stats->min = min;
+    }
+    if (stats->count == 0 || max > stats->max) {
+        stats->max = max;
+    }
+    stats->sum += sum;
+    stats->count += count;
+}
+
+/**
+ * Prints one window's statistics, if it holds any samples.
+ *
+ * @param[in] start  Start time of the window.
+ * @param[in] width  Width of the window.
+ * @param[in] stats  Pointer to the `WindowStats`.
+ */
+static void window_print(long long start, long long width, const WindowStats *stats) {
+    if (stats->count > 0) {
+        printf("%lld-%lld: min %d max %d mean %.2f (%lld samples)\n",
+               start, start + width, stats->min, stats->max, (double)stats->sum / stats->count, stats->count);
+    }
+}
+
+/**
+ * Prints every sample of a column between `t0` and `t1`.
+ *
+ * @param[in] recording  Pointer to the `Recording`.
+ * @param[in] column     Column to print.
+ * @param[in] t0         Start of the range in milliseconds.
+ * @param[in] t1         End of the range in milliseconds.
+ */
+static void query_levels(const Recording *recording, int column, long long t0, long long t1) {
+    int block_samples = (int)recording->header->block_samples;
+    long long times[block_samples];
+    int values[block_samples];
+
+    for (int b = 0; b < recording->block_count; b++) {
+        const QueryBlock *block = &recording->blocks[b];
+        if (block->header->last_time_ms < t0 || block->header->first_time_ms > t1) {
+            continue;
+        }
+
+        int count = block_decode(block, column, times, values);
+        for (int i = 0; i < count; i++) {
+            if (times[i] >= t0 && times[i] <= t1) {
+                printf("%lld %d\n", times[i], values[i]);
+            }
+        }
+    }
+}
+
+/**
+ * Prints the min, max and mean of a column for each `width` millisecond window in [`t0`, `t1`).
+ *
+ * Blocks that fall inside a single window are summarized from their index without decoding.
+ *
+ * @param[in] recording  Pointer to the `Recording`.
+ * @param[in] column     Column to summarize.
+ * @param[in] t0         Start of the first window in milliseconds.
+ * @param[in] t1         End of the last window in milliseconds.
+ * @param[in] width      Width of each window in milliseconds.
+ */
+static void query_window(const Recording *recording, int column, long long t0, long long t1, long long width) {
+    int block_samples = (int)recording->header->block_samples;
+    long long times[block_samples];
+    int values[block_samples];
+    long long window = -1;
+    WindowStats stats = {0, 0, 0, 0};
+
+    for (int b = 0; b < recording->block_count; b++) {
+        const QueryBlock *block = &recording->blocks[b];
+        long long first = block->header->first_time_ms;
+        long long last = block->header->last_time_ms;
+
+        if (last < t0 || first >= t1) {
+            continue;
+        }
+
+        if (first >= t0 && last < t1 && (first - t0) / width == (last - t0) / width) {
+            // The whole block lies in one window, use its summary
+            const RecordingColumnSummary *summary = &block->summaries[column];
+            if ((first - t0) / width != window) {
+                window_print(t0 + window * width, width, &stats);
+                window = (first - t0) / width;
+                memset(&stats, 0, sizeof(stats));
+            }
+            window_add(&stats, summary->min, summary->max, summary->sum, block->header->sample_count);
+            continue;
+        }
+
+        int count = block_decode(block, column, times, values);
+        for (int i = 0; i < count; i++) {
+            if (times[i] < t0 || times[i] >= t1) {
+                continue;
+            }
+            if ((times[i] - t0) / width != window) {
+                window_print(t0 + window * width, width, &stats);
+                window = (times[i] - t0) / width;
+                memset(&stats, 0, sizeof(stats));
+            }
+            window_add(&stats, values[i], values[i], values[i], 1);
+        }
+    }
+
+    window_print(t0 + window * width, width, &stats);
+}
+
+/**
+ * Prints the first time a column was at or below (or at or above) `level`.
+ *
+ * Blocks whose min/max show they never reach the level are skipped without decoding.
+ *
+ * @param[in] recording  Pointer to the `Recording`.
+ * @param[in] column     Column to search.
+ * @param[in] below      Non-zero to search for values at or below `level`, zero for at or above.
+ * @param[in] level      The threshold.
+ */
+static void query_cross(const Recording *recording, int column, int below, int level) {
+    int block_samples = (int)recording->header->block_samples;
+    long long times[block_samples];
+    int values[block_samples];
+
+    for (int b = 0; b < recording->block_count; b++) {
+        const QueryBlock *block = &recording->blocks[b];
+        const RecordingColumnSummary *summary = &block->summaries[column];
+
+        if ((below && summary->min > level) || (!below && summary->max < level)) {
+            continue;
+        }
+
+        int count = block_decode(block, column, times, values);
+        for (int i = 0; i < count; i++) {
+            if ((below && values[i] <= level) || (!below && values[i] >= level)) {
+                printf("%lld %d\n", times[i], values[i]);
+                return;
+            }
+        }
+    }
+
+    printf("never\n");
+}
+
+/**
+ * Prints the events of a trace as they are decoded.
+ *
+ * The file is read in fixed chunks; a record cut at the end of a chunk is moved to the
+ * front of the buffer and completed by the next read.
+ *
+ * @param[in] path  Path of the trace file.
+ * @param[in] name  Only print events of the system or resource with this name, NULL for all.
+ * @return          `EXIT_SUCCESS`, or `EXIT_FAILURE` if the trace cannot be read.
+ */
+static int query_trace(const char *path, const char *name) {
+    unsigned char buffer[OUTPUT_PAGE_SIZE];
+    TraceHeader header;
+    TraceCodec codec;
+    TraceRecord record;
+    size_t filled = 0;
+    ssize_t got;
+    int fd, count, result = EXIT_SUCCESS;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open trace");
+        return EXIT_FAILURE;
+    }
+    if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)
+        || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s is not a trace this tool can read.\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    count = (int)(header.resource_count + header.system_count);
+    char *names[count > 0 ? count : 1];
+    if (trace_read_names(fd, &header, names) != 0) {
+        fprintf(stderr, "%s is too short to be a trace.\n", path);
+        result = EXIT_FAILURE;
+        got = 0;
+    } else {
+        trace_codec_init(&codec, header.time_unit_ns);
+        got = 1;
+    }
+
+    while (got > 0 && (got = read(fd, buffer + filled, sizeof(buffer) - filled)) > 0) {
+        const unsigned char *cursor = buffer, *end = buffer + filled + got;
+        int length;
+
+        while ((length = trace_decode(&codec, cursor, end, &record)) > 0) {
+            const char *system = (record.system >= 0 && record.system < (int)header.system_count)
+                               ? names[header.resource_count + record.system] : "-";
+            const char *resource = (record.resource >= 0 && record.resource < (int)header.resource_count)
+                                 ? names[record.resource] : "-";
+
+            cursor += length;
+            if (name == NULL || strcmp(name, system) == 0 || strcmp(name, resource) == 0) {
+                printf("%lld %s %s %d %d %d\n", (long long)(record.time_ns / 1000), system, resource,
+                       record.status, record.priority, record.amount);
+            }
+        }
+        if (length < 0) {
+            fprintf(stderr, "%s is corrupt.\n", path);
+            result = EXIT_FAILURE;
+            break;
+        }
+
+        filled = (size_t)(end - cursor);
+        memmove(buffer, cursor, filled);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    close(fd);
+    return result;
+}
+
+/**
+ * Reads the resource and system names that follow a trace's header.
+ *
+ * @param[in]  fd      Trace file, positioned after the header.
+ * @param[in]  header  Pointer to the trace's `TraceHeader`.
+ * @param[out] names   Receives the resource names followed by the system names.
+ * @return             0 on success, -1 if the file ends first.
+ */
+static int trace_read_names(int fd, const TraceHeader *header, char **names) {
+    int count = (int)(header->resource_count + header->system_count);
+    uint16_t length;
+
+    for (int i = 0; i < count; i++) {
+        names[i] = NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (read(fd, &length, sizeof(length)) != (ssize_t)sizeof(length)) {
+            return -1;
+        }
+        names[i] = (char *)malloc(length + 1);
+        if (names[i] == NULL) {
+            fprintf(stderr, "Failed to allocate memory for trace name.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (read(fd, names[i], length) != (ssize_t)length) {
+            return -1;
+        }
+        names[i][length] = '\0';
+    }
+    return 0;
+}
+
+/**
+ * Prints the supported queries.
+ *
+ * @param[in] program  Name the program was run as.
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s FILE levels NAME T0 T1\n", program);
+    fprintf(stderr, "       %s FILE window NAME T0 T1 WIDTH\n", program);
+    fprintf(stderr, "       %s FILE cross NAME below|above LEVEL\n", program);
+    fprintf(stderr, "       %s FILE trace [NAME]\n", program);
+    fprintf(stderr, "Times are milliseconds since the start of the recording, trace times are microseconds.\n");
+}
@@ -0,0 +1,128 @@
+#include "defs.h"
+#include <math.h>
+#include <string.h>
+
+/* Counter-based random streams used to vary processing times */
+
+// Each value is a hash of the stream's key and a counter, so streams need no shared state
+// and no locking: a system thread owns its stream, and the same seed and stream number
+// always give the same sequence. A draw is a handful of multiplies and shifts.
+
+static uint64_t random_mix(uint64_t value);
+
+/**
+ * Initializes a random stream.
+ *
+ * Streams with the same seed but different stream numbers are independent.
+ *
+ * @param[out] stream     Pointer to the `RandomStream` to initialize.
+ * @param[in]  seed       Seed shared by every stream of a run.
+ * @param[in]  stream_id  Number of this stream, e.g. the index of its system.
+ */
+void random_stream_init(RandomStream *stream, uint64_t seed, uint64_t stream_id) {
+    stream->key = random_mix(seed ^ random_mix(stream_id + 0x9E3779B97F4A7C15ull));
+    stream->counter = 0;
+}
+
+/**
+ * Draws the next 64 random bits from a stream.
+ *
+ * @param[in,out] stream  Pointer to the `RandomStream`.
+ * @return                The random bits.
+ */
+uint64_t random_next(RandomStream *stream) {
+    return random_mix(stream->key + ++stream->counter * 0x9E3779B97F4A7C15ull);
+}
+
+/**
+ * Draws a uniformly distributed value in [0, 1).
+ *
+ * @param[in,out] stream  Pointer to the `RandomStream`.
+ * @return                The value.
+ */
+double random_uniform(RandomStream *stream) {
+    return (random_next(stream) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * Draws a normally distributed value with mean 0 and standard deviation 1.
+ *
+ * Uses the Box-Muller transform on two uniform values.
+ *
+ * @param[in,out] stream  Pointer to the `RandomStream`.
+ * @return                The value.
+ */
+double random_normal(RandomStream *stream) {
+    double u1 = 1.0 - random_uniform(stream);    // (0, 1], so the log is finite
+    double u2 = random_uniform(stream);
+
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * Draws an exponentially distributed value with mean 1.
+ *
+ * @param[in,out] stream  Pointer to the `RandomStream`.
+ * @return                The value.
+ */
+double random_exponential(RandomStream *stream) {
+    return -log(1.0 - random_uniform(stream));
+}
+
+/**
+ * Draws a processing time around `base` milliseconds.
+ *
+ * @param[in,out] stream        Pointer to the `RandomStream`.
+ * @param[in]     distribution  One of the `PROCESSING_*` distributions.
+ * @param[in]     base          The mean processing time.
+ * @param[in]     spread        Half-width for `PROCESSING_UNIFORM`, standard deviation for `PROCESSING_NORMAL`.
+ * @return                      The processing time in milliseconds, never negative.
+ */
+int random_processing_time(RandomStream *stream, int distribution, int base, int spread) {
+    double value;
+
+    switch (distribution) {
+        case PROCESSING_UNIFORM:
+            value = base + spread * (2.0 * random_uniform(stream) - 1.0);
+            break;
+        case PROCESSING_NORMAL:
+            value = base + spread * random_normal(stream);
+            break;
+        case PROCESSING_EXPONENTIAL:
+            value = base * random_exponential(stream);
+            break;
+        default:
+            return base;
+    }
+
+    return (value > 0.0) ? (int)(value + 0.5) : 0;
+}
+
+/**
+ * Maps a distribution name to its `PROCESSING_*` code.
+ *
+ * @param[in] name  "fixed", "uniform", "normal" or "exponential".
+ * @return          The code, or -1 if the name is not known.
+ */
+int random_distribution_from_name(const char *name) {
+    static const char *names[] = {"fixed", "uniform", "normal", "exponential"};
+
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Scrambles 64 bits (the SplitMix64 finalizer).
+ *
+ * @param[in] value  The value to scramble.
+ * @return           The scrambled value.
+ */
+static uint64_t random_mix(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
@@ -2,6 +2,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+
+// Helpers used by the different synchronization strategies, only visible in this file
+
+static int resource_apply(int *amount, int max_capacity, int op, int request);
+static int resource_consume_mutex(Resource *resource, int amount);
+static int resource_store_mutex(Resource *resource, int amount);
+static int resource_consume_cas(Resource *resource, int amount);
+static int resource_store_cas(Resource *resource, int amount);
+static int resource_combine_request(Resource *resource, int op, int amount);
+static void resource_combine(Resource *resource);
+static int resource_hand_off(Resource *resource, int amount);
+static void resource_track_level(Resource *resource);
+static int resource_next_level(const Resource *resource, int level, int amount);
+static void resource_lock(pthread_mutex_t *lock);
+
+// Nanoseconds the calling thread has spent blocked on resource locks, see `resource_blocked_ns`
+static _Thread_local long long resource_thread_blocked_ns = 0;
 
 /* Resource functions */
 
@@ -35,9 +55,21 @@ void resource_create(Resource **resource, const char *name, int amount, int max_
     strcpy((*resource)->name, name);
 
     // Initialize the fields
-    (*resource)->amount = amount;
+    atomic_init(&(*resource)->amount, amount);
     (*resource)->max_capacity = max_capacity;
-
+    (*resource)->sync_mode = RESOURCE_SYNC_MUTEX;
+    (*resource)->slots = NULL;
+    pthread_mutex_init(&(*resource)->lock, NULL);
+    atomic_init(&(*resource)->exchange_state, EXCHANGE_EMPTY);
+    (*resource)->exchange_amount = 0;
+    pthread_mutex_init(&(*resource)->exchange_lock, NULL);
+    pthread_cond_init(&(*resource)->exchange_cond, NULL);
+    (*resource)->event_queue = NULL;
+    (*resource)->low_threshold = -1;
+    (*resource)->hysteresis = -1;
+    (*resource)->id = -1;
+    (*resource)->role = RESOURCE_ROLE_NONE;
+    atomic_init(&(*resource)->level, resource_next_level(*resource, RESOURCE_LEVEL_NORMAL, amount));
 }
 
 /**
@@ -53,10 +85,570 @@ void resource_destroy(Resource *resource) {
             free(resource->name);
             resource->name = NULL;
         }
+        free(resource->slots);
+        pthread_mutex_destroy(&resource->lock);
+        pthread_mutex_destroy(&resource->exchange_lock);
+        pthread_cond_destroy(&resource->exchange_cond);
         free(resource);
     }
 }
 
+/**
+ * Selects how consume and store operations on a `Resource` are synchronized.
+ *
+ * Must be called before any thread starts using the resource. Switching to
+ * `RESOURCE_SYNC_COMBINE` allocates the publication list used by the combiner.
+ *
+ * @param[in,out] resource   Pointer to the `Resource` to configure.
+ * @param[in]     sync_mode  One of `RESOURCE_SYNC_MUTEX`, `RESOURCE_SYNC_CAS` or `RESOURCE_SYNC_COMBINE`.
+ */
+void resource_set_sync_mode(Resource *resource, int sync_mode) {
+    if (sync_mode == RESOURCE_SYNC_COMBINE && resource->slots == NULL) {
+        resource->slots = (CombineSlot *)aligned_alloc(CACHE_LINE_SIZE, RESOURCE_COMBINE_SLOTS * sizeof(CombineSlot));
+        if (resource->slots == NULL) {
+            fprintf(stderr, "Failed to allocate memory for Resource combining slots.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < RESOURCE_COMBINE_SLOTS; i++) {
+            atomic_init(&resource->slots[i].owner, 0);
+            atomic_init(&resource->slots[i].pending, 0);
+            resource->slots[i].op = 0;
+            resource->slots[i].amount = 0;
+            resource->slots[i].result = 0;
+        }
+    }
+    resource->sync_mode = sync_mode;
+}
+
+/**
+ * Consumes `amount` units from a `Resource`.
+ *
+ * Either the full amount is taken or nothing is, using the resource's synchronization strategy.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to consume from.
+ * @param[in]     amount    Amount to consume.
+ * @return                  `STATUS_OK` if consumed, otherwise `STATUS_EMPTY` or `STATUS_INSUFFICIENT`.
+ */
+int resource_consume(Resource *resource, int amount) {
+    int status;
+
+    switch (resource->sync_mode) {
+        case RESOURCE_SYNC_CAS:
+            status = resource_consume_cas(resource, amount);
+            break;
+        case RESOURCE_SYNC_COMBINE:
+            status = resource_combine_request(resource, COMBINE_OP_CONSUME, amount);
+            break;
+        default:
+            status = resource_consume_mutex(resource, amount);
+    }
+
+    if (status == STATUS_OK) {
+        resource_track_level(resource);
+    }
+    flight_record(FLIGHT_CONSUME, resource->id, amount, status, atomic_load_explicit(&resource->amount, memory_order_relaxed), 0);
+    return status;
+}
+
+/**
+ * Consumes `amount` units from a `Resource`, waiting up to `timeout_ms` for a producer if it runs short.
+ *
+ * While waiting, the consumer holds the resource's hand-off slot so the next producer to
+ * store enough can give its amount directly to the consumer instead of going through the
+ * shared amount. Only one consumer can hold the slot at a time; others wait for it to free up.
+ *
+ * @param[in,out] resource    Pointer to the `Resource` to consume from.
+ * @param[in]     amount      Amount to consume.
+ * @param[in]     timeout_ms  Longest time to wait for a producer, in milliseconds.
+ * @return                    `STATUS_OK` if consumed, otherwise `STATUS_EMPTY` or `STATUS_INSUFFICIENT`.
+ */
+int resource_consume_wait(Resource *resource, int amount, int timeout_ms) {
+    struct timespec deadline;
+    int status, timed_out = 0;
+
+    status = resource_consume(resource, amount);
+    if (status == STATUS_OK || timeout_ms <= 0) {
+        return status;
+    }
+
+    // Condition variables wait against CLOCK_REALTIME by default
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    timespec_add_ms(&deadline, timeout_ms);
+
+    resource_lock(&resource->exchange_lock);
+
+    // Wait for the slot if another consumer is already holding it
+    while (atomic_load(&resource->exchange_state) != EXCHANGE_EMPTY && !timed_out) {
+        timed_out = (pthread_cond_timedwait(&resource->exchange_cond, &resource->exchange_lock, &deadline) == ETIMEDOUT);
+    }
+
+    if (!timed_out) {
+        resource->exchange_amount = amount;
+        atomic_store_explicit(&resource->exchange_state, EXCHANGE_WAITING, memory_order_release);
+
+        while (atomic_load(&resource->exchange_state) == EXCHANGE_WAITING && !timed_out) {
+            timed_out = (pthread_cond_timedwait(&resource->exchange_cond, &resource->exchange_lock, &deadline) == ETIMEDOUT);
+        }
+
+        if (atomic_load(&resource->exchange_state) == EXCHANGE_FILLED) {
+            status = STATUS_OK;
+        }
+
+        // Free the slot for the next consumer
+        atomic_store_explicit(&resource->exchange_state, EXCHANGE_EMPTY, memory_order_release);
+        pthread_cond_broadcast(&resource->exchange_cond);
+    }
+
+    pthread_mutex_unlock(&resource->exchange_lock);
+
+    // A producer may have stored to the shared amount before we started waiting
+    if (status != STATUS_OK) {
+        status = resource_consume(resource, amount);
+    }
+
+    return status;
+}
+
+/**
+ * Stores up to `amount` units into a `Resource`, limited by its maximum capacity.
+ *
+ * If a consumer is waiting on the resource and `amount` covers what it needs, that part is
+ * handed to the consumer directly and only the rest is stored.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to store into.
+ * @param[in]     amount    Amount the caller would like to store.
+ * @return                  The amount actually stored or handed off (between 0 and `amount`).
+ */
+int resource_store(Resource *resource, int amount) {
+    int handed = resource_hand_off(resource, amount);
+
+    if (amount == handed) {
+        flight_record(FLIGHT_STORE, resource->id, amount, handed, atomic_load_explicit(&resource->amount, memory_order_relaxed), 0);
+        return handed;
+    }
+
+    switch (resource->sync_mode) {
+        case RESOURCE_SYNC_CAS:
+            handed += resource_store_cas(resource, amount - handed);
+            break;
+        case RESOURCE_SYNC_COMBINE:
+            handed += resource_combine_request(resource, COMBINE_OP_STORE, amount - handed);
+            break;
+        default:
+            handed += resource_store_mutex(resource, amount - handed);
+    }
+
+    // A store that did not fit at all still tells us the resource is full
+    resource_track_level(resource);
+    flight_record(FLIGHT_STORE, resource->id, amount, handed, atomic_load_explicit(&resource->amount, memory_order_relaxed), 0);
+    return handed;
+}
+
+/**
+ * Sets the thresholds a `Resource` reports crossings of.
+ *
+ * The resource reports `STATUS_LOW` when its amount falls to `low_threshold`, `STATUS_EMPTY`
+ * when it reaches zero and `STATUS_CAPACITY` when it fills up. Each is reported once, when
+ * the resource enters that level; it must move `hysteresis` back past the threshold before
+ * it leaves the level and can report it again.
+ *
+ * @param[in,out] resource       Pointer to the `Resource` to configure.
+ * @param[in]     low_threshold  Low threshold, or -1 for `THRESHOLD_RESOURCE_LOW` of the capacity.
+ * @param[in]     hysteresis     Width of the band, or -1 for `THRESHOLD_HYSTERESIS` of the capacity.
+ */
+void resource_set_thresholds(Resource *resource, int low_threshold, int hysteresis) {
+    resource->low_threshold = low_threshold;
+    resource->hysteresis = hysteresis;
+    atomic_store(&resource->level, resource_next_level(resource, RESOURCE_LEVEL_NORMAL, atomic_load(&resource->amount)));
+}
+
+/**
+ * Sets the queue that receives a `Resource`'s threshold events.
+ *
+ * @param[in,out] resource     Pointer to the `Resource` to configure.
+ * @param[in]     event_queue  Pointer to the `EventQueue`, or NULL to stop reporting.
+ */
+void resource_set_event_queue(Resource *resource, EventQueue *event_queue) {
+    resource->event_queue = event_queue;
+}
+
+/**
+ * Sets the role of a `Resource`, which chooses the manager policy rules that apply to it.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` to configure.
+ * @param[in]     role      One of the `RESOURCE_ROLE_*` codes.
+ */
+void resource_set_role(Resource *resource, int role) {
+    resource->role = role;
+}
+
+/**
+ * Moves a `Resource` to the level its amount is now at, reporting it if it got worse.
+ *
+ * Many threads may see the same crossing; the compare-and-swap on the level makes sure
+ * only one of them reports it.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` whose amount just changed.
+ */
+static void resource_track_level(Resource *resource) {
+    int level = atomic_load_explicit(&resource->level, memory_order_relaxed);
+    int amount = atomic_load(&resource->amount);
+    int next = resource_next_level(resource, level, amount);
+    Event event;
+
+    if (next == level || !atomic_compare_exchange_strong(&resource->level, &level, next)) {
+        return;
+    }
+    if (resource->event_queue == NULL) {
+        return;
+    }
+
+    // Climbing back up from EMPTY to LOW, or leaving a level for NORMAL, needs no reaction
+    switch (next) {
+        case RESOURCE_LEVEL_EMPTY:
+            event_init(&event, NULL, resource, STATUS_EMPTY, PRIORITY_HIGH, amount);
+            break;
+        case RESOURCE_LEVEL_LOW:
+            if (level == RESOURCE_LEVEL_EMPTY) {
+                return;
+            }
+            event_init(&event, NULL, resource, STATUS_LOW, PRIORITY_MED, amount);
+            break;
+        case RESOURCE_LEVEL_FULL:
+            event_init(&event, NULL, resource, STATUS_CAPACITY, PRIORITY_LOW, amount);
+            break;
+        default:
+            return;
+    }
+    event.from_level = level;
+    event.to_level = next;
+    event_publish(resource->event_queue, &event);
+}
+
+/**
+ * Names a `RESOURCE_LEVEL_*` code for display.
+ *
+ * @param[in] level  The level.
+ * @return           Its name.
+ */
+const char *resource_level_name(int level) {
+    switch (level) {
+        case RESOURCE_LEVEL_LOW:
+            return "LOW";
+        case RESOURCE_LEVEL_EMPTY:
+            return "EMPTY";
+        case RESOURCE_LEVEL_FULL:
+            return "FULL";
+        default:
+            return "NORMAL";
+    }
+}
+
+/**
+ * Time the calling thread has spent blocked on resource locks since it started.
+ *
+ * Only contended acquisitions are timed, so uncontended ones cost nothing extra.
+ *
+ * @return  The time in nanoseconds.
+ */
+long long resource_blocked_ns(void) {
+    return resource_thread_blocked_ns;
+}
+
+/**
+ * Locks one of a resource's mutexes, timing how long the calling thread is blocked.
+ *
+ * @param[in,out] lock  The mutex.
+ */
+static void resource_lock(pthread_mutex_t *lock) {
+    struct timespec start, end;
+
+    if (pthread_mutex_trylock(lock) == 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    resource_thread_blocked_ns += timespec_elapsed_ns(&start, &end);
+}
+
+/**
+ * Works out which level a `Resource` is at, with hysteresis.
+ *
+ * @param[in] resource  Pointer to the `Resource`.
+ * @param[in] level     The level it was at.
+ * @param[in] amount    Its amount now.
+ * @return              The `RESOURCE_LEVEL_*` it is at now.
+ */
+static int resource_next_level(const Resource *resource, int level, int amount) {
+    int capacity = resource->max_capacity;
+    int low = (resource->low_threshold >= 0) ? resource->low_threshold : (int)(capacity * THRESHOLD_RESOURCE_LOW);
+    int band = (resource->hysteresis >= 0) ? resource->hysteresis : (int)(capacity * THRESHOLD_HYSTERESIS);
+
+    if (band < 1) {
+        band = 1;
+    }
+
+    // Stay at the current level until the amount is back past its threshold by the band
+    switch (level) {
+        case RESOURCE_LEVEL_EMPTY:
+            if (amount < band) {
+                return RESOURCE_LEVEL_EMPTY;
+            }
+            break;
+        case RESOURCE_LEVEL_LOW:
+            if (amount > 0 && amount < low + band) {
+                return RESOURCE_LEVEL_LOW;
+            }
+            break;
+        case RESOURCE_LEVEL_FULL:
+            if (amount > capacity - band) {
+                return RESOURCE_LEVEL_FULL;
+            }
+            break;
+    }
+
+    if (amount <= 0) {
+        return RESOURCE_LEVEL_EMPTY;
+    }
+    if (amount >= capacity) {
+        return RESOURCE_LEVEL_FULL;
+    }
+    if (amount <= low) {
+        return RESOURCE_LEVEL_LOW;
+    }
+    return RESOURCE_LEVEL_NORMAL;
+}
+
+/**
+ * Hands part of a producer's amount directly to a consumer waiting on the resource.
+ *
+ * The check for a waiting consumer is a single atomic load, so producers pay nothing
+ * when no consumer is starved.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Amount the producer is storing.
+ * @return                  The amount handed to the consumer, zero if none was.
+ */
+static int resource_hand_off(Resource *resource, int amount) {
+    int handed = 0;
+
+    if (atomic_load_explicit(&resource->exchange_state, memory_order_acquire) != EXCHANGE_WAITING) {
+        return 0;
+    }
+
+    resource_lock(&resource->exchange_lock);
+    if (atomic_load(&resource->exchange_state) == EXCHANGE_WAITING && resource->exchange_amount <= amount) {
+        handed = resource->exchange_amount;
+        atomic_store_explicit(&resource->exchange_state, EXCHANGE_FILLED, memory_order_release);
+        pthread_cond_broadcast(&resource->exchange_cond);
+    }
+    pthread_mutex_unlock(&resource->exchange_lock);
+
+    return handed;
+}
+
+/**
+ * Applies a single consume or store request to a plain amount.
+ *
+ * Shared by every strategy so they all follow the same rules.
+ *
+ * @param[in,out] amount        Current amount of the resource, updated in place.
+ * @param[in]     max_capacity  Maximum capacity of the resource.
+ * @param[in]     op            `COMBINE_OP_CONSUME` or `COMBINE_OP_STORE`.
+ * @param[in]     request       Amount requested by the caller.
+ * @return                      Status for a consume, amount stored for a store.
+ */
+static int resource_apply(int *amount, int max_capacity, int op, int request) {
+    int available_space;
+
+    if (op == COMBINE_OP_CONSUME) {
+        if (*amount >= request) {
+            *amount -= request;
+            return STATUS_OK;
+        }
+        return (*amount == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
+    }
+
+    available_space = max_capacity - *amount;
+    if (available_space <= 0) {
+        return 0;
+    }
+    if (request > available_space) {
+        request = available_space;
+    }
+    *amount += request;
+    return request;
+}
+
+/**
+ * Consumes from a `Resource` while holding its mutex.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Amount to consume.
+ * @return                  `STATUS_OK`, `STATUS_EMPTY` or `STATUS_INSUFFICIENT`.
+ */
+static int resource_consume_mutex(Resource *resource, int amount) {
+    int current, status;
+
+    resource_lock(&resource->lock);
+    current = atomic_load_explicit(&resource->amount, memory_order_relaxed);
+    status = resource_apply(&current, resource->max_capacity, COMBINE_OP_CONSUME, amount);
+    atomic_store_explicit(&resource->amount, current, memory_order_relaxed);
+    pthread_mutex_unlock(&resource->lock);
+
+    return status;
+}
+
+/**
+ * Stores into a `Resource` while holding its mutex.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Amount to store.
+ * @return                  The amount actually stored.
+ */
+static int resource_store_mutex(Resource *resource, int amount) {
+    int current, stored;
+
+    resource_lock(&resource->lock);
+    current = atomic_load_explicit(&resource->amount, memory_order_relaxed);
+    stored = resource_apply(&current, resource->max_capacity, COMBINE_OP_STORE, amount);
+    atomic_store_explicit(&resource->amount, current, memory_order_relaxed);
+    pthread_mutex_unlock(&resource->lock);
+
+    return stored;
+}
+
+/**
+ * Consumes from a `Resource` with a compare-and-swap loop, retrying if another thread won the race.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Amount to consume.
+ * @return                  `STATUS_OK`, `STATUS_EMPTY` or `STATUS_INSUFFICIENT`.
+ */
+static int resource_consume_cas(Resource *resource, int amount) {
+    int current = atomic_load_explicit(&resource->amount, memory_order_relaxed);
+    int updated, status;
+
+    do {
+        updated = current;
+        status = resource_apply(&updated, resource->max_capacity, COMBINE_OP_CONSUME, amount);
+        if (status != STATUS_OK) {
+            return status;
+        }
+    } while (!atomic_compare_exchange_weak(&resource->amount, &current, updated));
+
+    return STATUS_OK;
+}
+
+/**
+ * Stores into a `Resource` with a compare-and-swap loop, retrying if another thread won the race.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     amount    Amount to store.
+ * @return                  The amount actually stored.
+ */
+static int resource_store_cas(Resource *resource, int amount) {
+    int current = atomic_load_explicit(&resource->amount, memory_order_relaxed);
+    int updated, stored;
+
+    do {
+        updated = current;
+        stored = resource_apply(&updated, resource->max_capacity, COMBINE_OP_STORE, amount);
+        if (stored == 0) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak(&resource->amount, &current, updated));
+
+    return stored;
+}
+
+/**
+ * Publishes a request to the resource's flat-combining list and waits for it to be applied.
+ *
+ * The thread claims a slot, publishes its request, and then either becomes the combiner
+ * (by taking the resource lock) and applies every pending request in one pass, or waits
+ * for whichever thread is currently combining to apply it. If every slot is claimed the
+ * request is applied directly under the lock, which is always safe since combiners hold it too.
+ *
+ * @param[in,out] resource  Pointer to the `Resource`.
+ * @param[in]     op        `COMBINE_OP_CONSUME` or `COMBINE_OP_STORE`.
+ * @param[in]     amount    Amount requested.
+ * @return                  Result of the request, as returned by `resource_apply`.
+ */
+static int resource_combine_request(Resource *resource, int op, int amount) {
+    // Each thread remembers the slot it last used, so it usually claims it on the first try
+    static atomic_uint next_hint = 0;
+    static _Thread_local int slot_hint = -1;
+    CombineSlot *slot = NULL;
+    int i, expected, result;
+
+    if (slot_hint < 0) {
+        slot_hint = (int)(atomic_fetch_add(&next_hint, 1) % RESOURCE_COMBINE_SLOTS);
+    }
+
+    for (i = 0; i < RESOURCE_COMBINE_SLOTS && slot == NULL; i++) {
+        CombineSlot *candidate = &resource->slots[(slot_hint + i) % RESOURCE_COMBINE_SLOTS];
+        expected = 0;
+        if (atomic_compare_exchange_strong(&candidate->owner, &expected, 1)) {
+            slot = candidate;
+        }
+    }
+
+    if (slot == NULL) {
+        // More threads than slots, fall back to applying the request ourselves
+        return (op == COMBINE_OP_CONSUME) ? resource_consume_mutex(resource, amount)
+                                          : resource_store_mutex(resource, amount);
+    }
+
+    slot->op = op;
+    slot->amount = amount;
+    atomic_store_explicit(&slot->pending, 1, memory_order_release);
+
+    while (atomic_load_explicit(&slot->pending, memory_order_acquire)) {
+        if (pthread_mutex_trylock(&resource->lock) == 0) {
+            resource_combine(resource);
+            pthread_mutex_unlock(&resource->lock);
+        } else {
+            sched_yield();
+        }
+    }
+
+    result = slot->result;
+    atomic_store_explicit(&slot->owner, 0, memory_order_release);
+    return result;
+}
+
+/**
+ * Applies every pending request in the publication list in a single pass.
+ *
+ * The amount is read once and written once per pass, so the resource's cache line only
+ * moves once per batch no matter how many threads published requests. Must be called
+ * with the resource lock held.
+ *
+ * @param[in,out] resource  Pointer to the `Resource` being combined.
+ */
+static void resource_combine(Resource *resource) {
+    int batch[RESOURCE_COMBINE_SLOTS];
+    int count = 0;
+    int current = atomic_load_explicit(&resource->amount, memory_order_relaxed);
+
+    for (int i = 0; i < RESOURCE_COMBINE_SLOTS; i++) {
+        CombineSlot *slot = &resource->slots[i];
+        if (atomic_load_explicit(&slot->pending, memory_order_acquire)) {
+            slot->result = resource_apply(&current, resource->max_capacity, slot->op, slot->amount);
+            batch[count++] = i;
+        }
+    }
+
+    // Publish the new amount before releasing any waiter
+    atomic_store_explicit(&resource->amount, current, memory_order_release);
+
+    for (int i = 0; i < count; i++) {
+        atomic_store_explicit(&resource->slots[batch[i]].pending, 0, memory_order_release);
+    }
+}
+
 /* ResourceAmount functions */
 
 /**
@@ -162,7 +754,8 @@ void resource_array_add(ResourceArray *array, Resource *resource) {
         array->capacity = new_capacity;
     }
 
-    // Add the resource to the array
+    // Add the resource to the array, its position is its id in policy tables
+    resource->id = array->size;
     array->resources[array->size] = resource;
 
     // Increment the size of the array
@@ -0,0 +1,333 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Helper functions just used by this C file
+
+static Resource *runner_find_resource(Manager *manager, int role, const char *name);
+static void runner_record_usage(RunResult *result);
+
+/**
+ * Runs the simulation until the manager stops it.
+ *
+ * Starts the manager thread (unless the systems handle events inline) and one thread per
+ * system, waits for all of them to finish, and reports how the run ended. A `Manager`
+ * can be run again after `simulation_resume`.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ * @param[out]    result   Receives the outcome of the run.
+ */
+void simulation_run(Manager *manager, RunResult *result) {
+    int num_systems = manager->system_array.size;
+    pthread_t system_tids[num_systems];
+    pthread_t manager_tid;
+    Watchdog watchdog;
+    struct timespec end;
+
+    simulation_prepare(manager);
+
+    manager->result.outcome = OUTCOME_RUNNING;
+    manager->result.min_oxygen = (manager->oxygen != NULL) ? manager->oxygen->amount : 0;
+    atomic_store(&manager->event_queue.shed, 0);
+    manager->event_queue.backlog_peak = 0;
+    clock_gettime(CLOCK_MONOTONIC, &manager->start);
+    stall_reset(manager);
+
+    // Create manager thread, unless the systems handle events themselves
+    if (!manager->inline_manager && pthread_create(&manager_tid, NULL, manager_thread, (void*)manager) != 0) {
+        perror("Failed to create manager thread");
+        manager->result.outcome = OUTCOME_FAILED;
+        *result = manager->result;
+        return;
+    }
+
+    // Create system threads
+    for (int i = 0; i < num_systems; ++i) {
+        if (pthread_create(&system_tids[i], NULL, system_thread, (void*)manager->system_array.systems[i]) != 0) {
+            perror("Failed to create system thread");
+            // Signal termination to already created threads and wait for them
+            manager_terminate(manager, OUTCOME_FAILED);
+            for (int j = 0; j < i; ++j) {
+                pthread_join(system_tids[j], NULL);
+            }
+            if (!manager->inline_manager) {
+                pthread_join(manager_tid, NULL);
+            }
+            *result = manager->result;
+            return;
+        }
+    }
+
+    if (manager->watchdog) {
+        watchdog_start(&watchdog, manager);
+    }
+
+    // Wait for manager thread to finish, or for the systems to stop the run
+    if (manager->inline_manager) {
+        manager_wait(manager);
+    } else {
+        pthread_join(manager_tid, NULL);
+    }
+
+    // Wait for all system threads to finish
+    for (int i = 0; i < num_systems; ++i) {
+        pthread_join(system_tids[i], NULL);
+    }
+    manager->result.watchdog_alerts = manager->watchdog ? watchdog_stop(&watchdog) : 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    manager->result.elapsed_ms = timespec_elapsed_ns(&manager->start, &end) / 1000000LL;
+    manager->result.distance = (manager->distance != NULL) ? manager->distance->amount : 0;
+    manager->result.events_shed = atomic_load(&manager->event_queue.shed);
+    manager->result.event_backlog_peak = manager->event_queue.backlog_peak;
+    *result = manager->result;
+}
+
+/**
+ * Finds the resources a run's outcome is measured on, if the scenario has not set them,
+ * sends every resource's threshold events to the manager, compiles the manager's policy,
+ * gives every system its channel to the manager if channels are used and, without a
+ * manager thread, makes publishing events run the manager's pass.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ */
+void simulation_prepare(Manager *manager) {
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        Resource *resource = manager->resource_array.resources[i];
+        if (resource->event_queue == NULL) {
+            resource_set_event_queue(resource, &manager->event_queue);
+        }
+    }
+
+    if (manager->oxygen == NULL) {
+        manager->oxygen = runner_find_resource(manager, RESOURCE_ROLE_LIFE, "Oxygen");
+    }
+    if (manager->distance == NULL) {
+        manager->distance = runner_find_resource(manager, RESOURCE_ROLE_DESTINATION, "Distance");
+    }
+
+    policy_compile(&manager->policy, manager, manager->policy_rules, manager->policy_rule_count);
+
+    // Without a manager thread, whichever system publishes events handles them
+    manager->event_queue.on_publish = manager->inline_manager ? manager_combine : NULL;
+    manager->event_queue.publish_context = manager;
+
+    // Fresh channels each run, so nothing left from an earlier run is handled
+    if (manager->use_channels) {
+        event_channels_init(&manager->channels, manager->system_array.size);
+        for (int i = 0; i < manager->system_array.size; i++) {
+            manager->system_array.systems[i]->event_stage->channel = &manager->channels.channels[i];
+        }
+    }
+}
+
+/**
+ * Prepares a stopped simulation to continue from its current state.
+ *
+ * Resource amounts and stored amounts are kept, systems go back to `STANDARD`
+ * and any events left from the previous run are discarded.
+ *
+ * @param[in,out] manager  Pointer to the `Manager` to resume.
+ */
+void simulation_resume(Manager *manager) {
+    Event event;
+
+    while (event_queue_pop(&manager->event_queue, &event)) {
+        // Discard events from the previous run
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        atomic_store_explicit(&manager->system_array.systems[i]->status, STANDARD, memory_order_relaxed);
+    }
+    atomic_store_explicit(&manager->simulation_running, 1, memory_order_relaxed);
+    manager->result.outcome = OUTCOME_RUNNING;
+}
+
+/**
+ * Seeds the random streams the systems draw their processing times from.
+ *
+ * Every system gets its own stream, numbered by its position in the scenario, so a run
+ * is reproducible from `seed` no matter how the system threads interleave.
+ *
+ * @param[in,out] manager  Pointer to the loaded `Manager`.
+ * @param[in]     seed     The seed.
+ */
+void simulation_seed(Manager *manager, uint64_t seed) {
+    for (int i = 0; i < manager->system_array.size; i++) {
+        random_stream_init(&manager->system_array.systems[i]->random, seed, (uint64_t)i);
+    }
+}
+
+/**
+ * Runs many variants of the loaded scenario in parallel, one forked worker per variant.
+ *
+ * The scenario is loaded once by the caller; each worker inherits it copy-on-write, calls
+ * `setup` to turn it into its variant, runs it headless and writes its result into a
+ * table shared with the parent. Pages the worker never writes stay shared with the parent,
+ * and each result records how many pages the worker faulted in. At most `jobs` workers
+ * run at once. Must be called while the simulation is stopped, since only the calling
+ * thread survives a fork.
+ *
+ * @param[in,out] manager        Pointer to the loaded (and stopped) `Manager`.
+ * @param[in]     variant_count  Number of variants to run.
+ * @param[in]     jobs           Largest number of workers running at once.
+ * @param[in]     setup          Called in each worker with its variant number before it runs.
+ * @param[in]     context        Passed through to `setup`.
+ * @param[out]    results        Receives `variant_count` results, `OUTCOME_FAILED` for workers that crashed.
+ */
+void runner_run_variants(Manager *manager, int variant_count, int jobs, VariantSetup setup, void *context, RunResult *results) {
+    RunResult *table;
+    int running = 0, next = 0;
+    pid_t pid;
+
+    if (variant_count <= 0) {
+        return;
+    }
+    if (jobs <= 0) {
+        jobs = 1;
+    }
+
+    table = (RunResult *)mmap(NULL, variant_count * sizeof(RunResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+        perror("Failed to map results table");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < variant_count; i++) {
+        memset(&table[i], 0, sizeof(RunResult));
+        table[i].outcome = OUTCOME_FAILED;
+    }
+
+    // Anything still buffered would otherwise be printed again by every worker
+    fflush(stdout);
+    fflush(stderr);
+
+    while (next < variant_count || running > 0) {
+        while (running < jobs && next < variant_count) {
+            pid = fork();
+            if (pid == 0) {
+                // Workers run headless, their results come back through the table
+                manager->display = 0;
+                if (freopen("/dev/null", "w", stdout) == NULL) {
+                    _exit(EXIT_FAILURE);
+                }
+                setup(manager, next, context);
+                simulation_run(manager, &table[next]);
+                runner_record_usage(&table[next]);
+                _exit(EXIT_SUCCESS);
+            } else if (pid < 0) {
+                perror("Failed to fork worker");
+            } else {
+                running++;
+            }
+            next++;
+        }
+
+        if (running > 0) {
+            wait(NULL);
+            running--;
+        }
+    }
+
+    memcpy(results, table, variant_count * sizeof(RunResult));
+    munmap(table, variant_count * sizeof(RunResult));
+}
+
+/**
+ * Maps an `OUTCOME_*` code to a human-readable string.
+ *
+ * @param[in] outcome  The outcome code.
+ * @return             A static string describing it.
+ */
+const char *outcome_name(int outcome) {
+    switch (outcome) {
+        case OUTCOME_RUNNING:
+            return "RUNNING";
+        case OUTCOME_DESTINATION:
+            return "DESTINATION";
+        case OUTCOME_NO_OXYGEN:
+            return "NO_OXYGEN";
+        case OUTCOME_TIME_LIMIT:
+            return "TIME_LIMIT";
+        case OUTCOME_PRUNED:
+            return "PRUNED";
+        case OUTCOME_THRESHOLD:
+            return "THRESHOLD";
+        case OUTCOME_STALLED:
+            return "STALLED";
+        default:
+            return "FAILED";
+    }
+}
+
+/**
+ * Time a run took, or would take at its average rate, to reach its destination.
+ *
+ * Runs stopped early are projected from the distance they covered, so runs
+ * can be compared without running every one to the end.
+ *
+ * @param[in] result       Result of the run.
+ * @param[in] offset_ms    Time already spent before the run started (e.g. a shared warm-up).
+ * @param[in] destination  Distance needed to reach the destination.
+ * @return                 Milliseconds to destination, or zero if no distance was covered.
+ */
+double run_time_to_destination(const RunResult *result, long long offset_ms, int destination) {
+    double elapsed = (double)(offset_ms + result->elapsed_ms);
+
+    if (result->outcome == OUTCOME_DESTINATION) {
+        return elapsed;
+    }
+    if (result->distance <= 0) {
+        return 0.0;
+    }
+    return elapsed * destination / result->distance;
+}
+
+/**
+ * Finds the resource with a role.
+ *
+ * Scenarios that do not assign the role fall back to the resource called `name`,
+ * which is given the role so the manager's policy treats it the same way.
+ *
+ * @param[in,out] manager  Pointer to the `Manager`.
+ * @param[in]     role     One of the `RESOURCE_ROLE_*` codes.
+ * @param[in]     name     Name of the resource to use if none has the role.
+ * @return                 The resource, or NULL if there is none.
+ */
+static Resource *runner_find_resource(Manager *manager, int role, const char *name) {
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        if (manager->resource_array.resources[i]->role == role) {
+            return manager->resource_array.resources[i];
+        }
+    }
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        if (strcmp(manager->resource_array.resources[i]->name, name) == 0) {
+            resource_set_role(manager->resource_array.resources[i], role);
+            return manager->resource_array.resources[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Records a forked worker's memory use in its result.
+ *
+ * Minor faults count the pages the worker had to copy (or touch for the first time);
+ * everything else is still shared with the parent.
+ *
+ * @param[out] result  The worker's entry in the results table.
+ */
+static void runner_record_usage(RunResult *result) {
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        result->worker_faults = usage.ru_minflt;
+        result->worker_rss_kb = usage.ru_maxrss;
+    }
+}
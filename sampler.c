@@ -0,0 +1,304 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+// Helper functions just used by this C file
+
+static void *sampler_thread(void *arg);
+static void sampler_take_sample(Sampler *sampler);
+static void sampler_flush_block(Sampler *sampler);
+static void sampler_write_header(Sampler *sampler);
+static void column_init(SampleColumn *column, int capacity);
+static void column_reset(SampleColumn *column);
+static void column_append(SampleColumn *column, int value);
+
+/**
+ * Opens a recording file and starts the sampler thread.
+ *
+ * Every `interval_ms` the thread snapshots each resource amount and each system status.
+ * Samples are gathered into blocks of `SAMPLER_BLOCK_SAMPLES`, each column stored as
+ * zigzag varint deltas, and every full block is written to the file as soon as it fills.
+ * The sampler only reads the simulation's state, it never takes a lock the systems use,
+ * and blocks are written through `writer` so the sampler does not wait for the disk.
+ *
+ * @param[out]    sampler      Pointer to the `Sampler` to initialize.
+ * @param[in]     manager      Pointer to the `Manager` whose state is recorded.
+ * @param[in,out] writer       Pointer to the `OutputWriter` the recording is written with.
+ * @param[in]     path         Path of the recording file to create.
+ * @param[in]     interval_ms  Milliseconds between samples.
+ */
+void sampler_start(Sampler *sampler, Manager *manager, OutputWriter *writer, const char *path, int interval_ms) {
+    int resource_count = manager->resource_array.size;
+    int system_count = manager->system_array.size;
+
+    sampler->manager = manager;
+    sampler->interval_ms = (interval_ms > 0) ? interval_ms : SAMPLER_DEFAULT_INTERVAL;
+    sampler->block_samples = SAMPLER_BLOCK_SAMPLES;
+    sampler->sample_count = 0;
+    sampler->first_time_ms = 0;
+    sampler->last_time_ms = 0;
+    sampler->column_count = resource_count + system_count;
+
+    sampler->output = output_open(writer, path);
+    if (sampler->output == NULL) {
+        perror("Failed to open recording file");
+        exit(EXIT_FAILURE);
+    }
+
+    sampler->columns = (SampleColumn *)malloc(sampler->column_count * sizeof(SampleColumn));
+    if (sampler->columns == NULL) {
+        fprintf(stderr, "Failed to allocate memory for Sampler columns.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Most deltas are zero or small, so two bytes per sample rarely needs to grow
+    column_init(&sampler->time_column, sampler->block_samples * 2);
+    for (int i = 0; i < sampler->column_count; i++) {
+        column_init(&sampler->columns[i], sampler->block_samples * 2);
+    }
+
+    sampler_write_header(sampler);
+
+    clock_gettime(CLOCK_MONOTONIC, &sampler->start);
+    atomic_init(&sampler->running, 1);
+    if (pthread_create(&sampler->thread, NULL, sampler_thread, sampler) != 0) {
+        perror("Failed to create sampler thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Stops the sampler thread, flushes the last partial block and closes the recording.
+ *
+ * @param[in,out] sampler  Pointer to the `Sampler` to stop.
+ */
+void sampler_stop(Sampler *sampler) {
+    atomic_store(&sampler->running, 0);
+    pthread_join(sampler->thread, NULL);
+
+    // Take one last sample so the recording includes the final state
+    sampler_take_sample(sampler);
+    sampler_flush_block(sampler);
+    if (output_close(sampler->output) != 0) {
+        fprintf(stderr, "Failed to write the recording.\n");
+    }
+
+    free(sampler->time_column.data);
+    for (int i = 0; i < sampler->column_count; i++) {
+        free(sampler->columns[i].data);
+    }
+    free(sampler->columns);
+    sampler->columns = NULL;
+}
+
+/**
+ * Thread function for the sampler.
+ *
+ * Sleeps until each absolute sample time, so the sampling rate does not drift with the
+ * time spent encoding and writing.
+ *
+ * @param[in,out] arg  Pointer to the `Sampler`.
+ * @return             NULL
+ */
+static void *sampler_thread(void *arg) {
+    Sampler *sampler = (Sampler *)arg;
+    struct timespec next = sampler->start;
+
+    while (atomic_load(&sampler->running)) {
+        sampler_take_sample(sampler);
+        if (sampler->sample_count >= sampler->block_samples) {
+            sampler_flush_block(sampler);
+        }
+
+        timespec_add_ms(&next, sampler->interval_ms);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            // Interrupted by a signal, keep sleeping until the deadline
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Appends one snapshot of every resource amount and system status to the current block.
+ *
+ * @param[in,out] sampler  Pointer to the `Sampler`.
+ */
+static void sampler_take_sample(Sampler *sampler) {
+    Manager *manager = sampler->manager;
+    int resource_count = manager->resource_array.size;
+    struct timespec time;
+    long long now;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    now = timespec_elapsed_ns(&sampler->start, &time) / 1000000LL;
+    if (sampler->sample_count == 0) {
+        sampler->first_time_ms = now;
+    }
+    sampler->last_time_ms = now;
+
+    column_append(&sampler->time_column, (int)(now - sampler->first_time_ms));
+    for (int i = 0; i < resource_count; i++) {
+        column_append(&sampler->columns[i], atomic_load_explicit(&manager->resource_array.resources[i]->amount, memory_order_relaxed));
+    }
+    for (int i = 0; i < manager->system_array.size; i++) {
+        column_append(&sampler->columns[resource_count + i],
+                      atomic_load_explicit(&manager->system_array.systems[i]->status, memory_order_relaxed));
+    }
+
+    sampler->sample_count++;
+}
+
+/**
+ * Writes the current block to the recording file and starts a new one.
+ *
+ * Each block begins its deltas from zero, so readers can decode any block on its own.
+ *
+ * @param[in,out] sampler  Pointer to the `Sampler`.
+ */
+static void sampler_flush_block(Sampler *sampler) {
+    RecordingBlockHeader header;
+    RecordingColumnSummary summary;
+    uint32_t offset = 0;
+    SampleColumn *column;
+
+    if (sampler->sample_count == 0) {
+        return;
+    }
+
+    header.magic = RECORDING_BLOCK_MAGIC;
+    header.sample_count = (uint32_t)sampler->sample_count;
+    header.first_time_ms = sampler->first_time_ms;
+    header.last_time_ms = sampler->last_time_ms;
+    header.column_count = (uint32_t)sampler->column_count + 1;
+    header.payload_size = (uint32_t)sampler->time_column.size;
+    for (int i = 0; i < sampler->column_count; i++) {
+        header.payload_size += (uint32_t)sampler->columns[i].size;
+    }
+    output_write(sampler->output, &header, sizeof(header));
+
+    // Summaries for the time column followed by every data column
+    for (int i = -1; i < sampler->column_count; i++) {
+        column = (i < 0) ? &sampler->time_column : &sampler->columns[i];
+        summary.min = column->min;
+        summary.max = column->max;
+        summary.sum = column->sum;
+        summary.offset = offset;
+        summary.size = (uint32_t)column->size;
+        output_write(sampler->output, &summary, sizeof(summary));
+        offset += (uint32_t)column->size;
+    }
+
+    output_write(sampler->output, sampler->time_column.data, sampler->time_column.size);
+    column_reset(&sampler->time_column);
+    for (int i = 0; i < sampler->column_count; i++) {
+        output_write(sampler->output, sampler->columns[i].data, sampler->columns[i].size);
+        column_reset(&sampler->columns[i]);
+    }
+
+    // Readers following the recording see each block once it is written, without waiting for it here
+    output_flush(sampler->output);
+    sampler->sample_count = 0;
+}
+
+/**
+ * Writes the recording header, followed by the name and capacity of each resource and the name of each system.
+ *
+ * @param[in,out] sampler  Pointer to the `Sampler`.
+ */
+static void sampler_write_header(Sampler *sampler) {
+    Manager *manager = sampler->manager;
+    RecordingHeader header;
+    uint16_t length;
+    int32_t capacity;
+
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.resource_count = (uint32_t)manager->resource_array.size;
+    header.system_count = (uint32_t)manager->system_array.size;
+    header.interval_ms = (uint32_t)sampler->interval_ms;
+    header.block_samples = (uint32_t)sampler->block_samples;
+    output_write(sampler->output, &header, sizeof(header));
+
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        Resource *resource = manager->resource_array.resources[i];
+        length = (uint16_t)strlen(resource->name);
+        capacity = resource->max_capacity;
+        output_write(sampler->output, &length, sizeof(length));
+        output_write(sampler->output, resource->name, length);
+        output_write(sampler->output, &capacity, sizeof(capacity));
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        length = (uint16_t)strlen(system->name);
+        output_write(sampler->output, &length, sizeof(length));
+        output_write(sampler->output, system->name, length);
+    }
+}
+
+/**
+ * Allocates the buffer of a `SampleColumn` and resets it for a new block.
+ *
+ * @param[out] column    Pointer to the `SampleColumn` to initialize.
+ * @param[in]  capacity  Initial capacity in bytes.
+ */
+static void column_init(SampleColumn *column, int capacity) {
+    column->capacity = (capacity < VARINT_MAX_BYTES) ? VARINT_MAX_BYTES : capacity;
+    column->data = (unsigned char *)malloc(column->capacity);
+    if (column->data == NULL) {
+        fprintf(stderr, "Failed to allocate memory for SampleColumn.\n");
+        exit(EXIT_FAILURE);
+    }
+    column_reset(column);
+}
+
+/**
+ * Empties a `SampleColumn` for the next block, keeping its buffer.
+ *
+ * @param[in,out] column  Pointer to the `SampleColumn`.
+ */
+static void column_reset(SampleColumn *column) {
+    column->size = 0;
+    column->last = 0;
+    column->min = 0;
+    column->max = 0;
+    column->sum = 0;
+}
+
+/**
+ * Appends a value to a `SampleColumn` as a zigzag varint delta, doubling the buffer if needed.
+ *
+ * @param[in,out] column  Pointer to the `SampleColumn`.
+ * @param[in]     value   The sampled value.
+ */
+static void column_append(SampleColumn *column, int value) {
+    if (column->size + VARINT_MAX_BYTES > column->capacity) {
+        int new_capacity = column->capacity * 2;
+        unsigned char *new_data = (unsigned char *)malloc(new_capacity);
+        if (new_data == NULL) {
+            fprintf(stderr, "Failed to allocate memory while resizing SampleColumn.\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(new_data, column->data, column->size);
+        free(column->data);
+        column->data = new_data;
+        column->capacity = new_capacity;
+    }
+
+    if (column->size == 0 || value < column->min) {
+        column->min = value;
+    }
+    if (column->size == 0 || value > column->max) {
+        column->max = value;
+    }
+    column->sum += value;
+
+    column->size += varint_encode(zigzag_encode(value - column->last), column->data + column->size);
+    column->last = value;
+}
+
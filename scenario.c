@@ -0,0 +1,176 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Immutable scenario templates and the per-instance state that runs on them */
+
+// A `ScenarioTemplate` holds everything that stays the same while a scenario runs: which
+// resource each system consumes and produces, capacities and base parameters. Any
+// number of instances can share one template (and forked workers share its pages), so each
+// instance only needs a `ScenarioState`: a few `int`s per resource and system.
+
+static int scenario_resource_index(const Manager *manager, const Resource *resource);
+static int *scenario_alloc_ints(int count);
+
+/**
+ * Builds a `ScenarioTemplate` from the scenario loaded into `manager`.
+ *
+ * The current resource amounts, stored amounts and statuses become the initial state of
+ * new instances. The template copies everything it needs, so it stays valid after the
+ * `Manager` is cleaned.
+ *
+ * @param[out]    scenario  Pointer to the `ScenarioTemplate` to build.
+ * @param[in,out] manager   Pointer to the loaded `Manager`.
+ */
+void scenario_template_init(ScenarioTemplate *scenario, Manager *manager) {
+    int resources = manager->resource_array.size;
+    int systems = manager->system_array.size;
+    int *values;
+
+    simulation_prepare(manager);
+    scenario->resource_count = resources;
+    scenario->system_count = systems;
+    scenario->oxygen = scenario_resource_index(manager, manager->oxygen);
+    scenario->distance = scenario_resource_index(manager, manager->distance);
+
+    // One block for every number
+    values = scenario_alloc_ints(2 * resources + 7 * systems);
+    scenario->capacity = values;
+    scenario->initial_amount = values + resources;
+    scenario->consumed_index = values + 2 * resources;
+    scenario->consumed_amount = scenario->consumed_index + systems;
+    scenario->produced_index = scenario->consumed_amount + systems;
+    scenario->produced_amount = scenario->produced_index + systems;
+    scenario->processing_time = scenario->produced_amount + systems;
+    scenario->initial_stored = scenario->processing_time + systems;
+    scenario->initial_status = scenario->initial_stored + systems;
+
+    for (int r = 0; r < resources; r++) {
+        Resource *resource = manager->resource_array.resources[r];
+
+        scenario->capacity[r] = resource->max_capacity;
+        scenario->initial_amount[r] = atomic_load(&resource->amount);
+    }
+    for (int s = 0; s < systems; s++) {
+        System *system = manager->system_array.systems[s];
+        int status = atomic_load_explicit(&system->status, memory_order_relaxed);
+
+        scenario->consumed_index[s] = scenario_resource_index(manager, system->consumed.resource);
+        scenario->consumed_amount[s] = system->consumed.amount;
+        scenario->produced_index[s] = scenario_resource_index(manager, system->produced.resource);
+        scenario->produced_amount[s] = system->produced.amount;
+        scenario->processing_time[s] = system->processing_time;
+        scenario->initial_stored[s] = atomic_load_explicit(&system->amount_stored, memory_order_relaxed);
+        scenario->initial_status[s] = (status == TERMINATE) ? STANDARD : status;
+    }
+}
+
+/**
+ * Frees the memory used by a `ScenarioTemplate`.
+ *
+ * @param[in,out] scenario  Pointer to the `ScenarioTemplate` to clean.
+ */
+void scenario_template_clean(ScenarioTemplate *scenario) {
+    free(scenario->capacity);
+}
+
+/**
+ * Size of one instance's `ScenarioState`, in bytes.
+ *
+ * Arrays of states are laid out with this stride, see `scenario_state_at`.
+ *
+ * @param[in] scenario  Pointer to the `ScenarioTemplate`.
+ * @return              The size.
+ */
+size_t scenario_state_size(const ScenarioTemplate *scenario) {
+    return sizeof(ScenarioState) + (scenario->resource_count + SCENARIO_SYSTEM_FIELDS * scenario->system_count) * sizeof(int);
+}
+
+/**
+ * Allocates an array of `count` instance states, each set to the template's initial state.
+ *
+ * @param[in] scenario  Pointer to the `ScenarioTemplate`.
+ * @param[in] count     Number of states.
+ * @return              The array, to be freed with `free`.
+ */
+ScenarioState *scenario_state_array(const ScenarioTemplate *scenario, int count) {
+    size_t size = scenario_state_size(scenario);
+    ScenarioState *states = (ScenarioState *)malloc((count > 0 ? count : 1) * size);
+
+    if (states == NULL) {
+        fprintf(stderr, "Failed to allocate memory for ScenarioState.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        scenario_state_init(scenario, scenario_state_at(scenario, states, i));
+    }
+    return states;
+}
+
+/**
+ * Finds one state in an array allocated by `scenario_state_array`.
+ *
+ * @param[in] scenario  Pointer to the `ScenarioTemplate`.
+ * @param[in] states    The array.
+ * @param[in] index     Index of the state.
+ * @return              Pointer to the state.
+ */
+ScenarioState *scenario_state_at(const ScenarioTemplate *scenario, ScenarioState *states, int index) {
+    return (ScenarioState *)((char *)states + (size_t)index * scenario_state_size(scenario));
+}
+
+/**
+ * Sets an instance's state to the template's initial state.
+ *
+ * @param[in]  scenario  Pointer to the `ScenarioTemplate`.
+ * @param[out] state     Pointer to the `ScenarioState`.
+ */
+void scenario_state_init(const ScenarioTemplate *scenario, ScenarioState *state) {
+    int *system_values = state->values + scenario->resource_count;
+
+    state->outcome = OUTCOME_RUNNING;
+    state->elapsed = 0;
+    memcpy(state->values, scenario->initial_amount, scenario->resource_count * sizeof(int));
+    state->min_oxygen = (scenario->oxygen >= 0) ? scenario->initial_amount[scenario->oxygen] : 0;
+
+    for (int s = 0; s < scenario->system_count; s++) {
+        system_values[SCENARIO_STORED] = scenario->initial_stored[s];
+        system_values[SCENARIO_TIMER] = 0;
+        system_values[SCENARIO_WAIT] = 0;
+        system_values[SCENARIO_STATUS] = scenario->initial_status[s];
+        system_values += SCENARIO_SYSTEM_FIELDS;
+    }
+}
+
+/**
+ * Finds the index of a resource in the manager's resource array.
+ *
+ * @param[in] manager   Pointer to the `Manager`.
+ * @param[in] resource  The resource, may be NULL.
+ * @return              Its index, or -1 if it is NULL or not found.
+ */
+static int scenario_resource_index(const Manager *manager, const Resource *resource) {
+    for (int r = 0; resource != NULL && r < manager->resource_array.size; r++) {
+        if (manager->resource_array.resources[r] == resource) {
+            return r;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Allocates an array of `int`.
+ *
+ * @param[in] count  Number of values.
+ * @return           The array.
+ */
+static int *scenario_alloc_ints(int count) {
+    int *values = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+
+    if (values == NULL) {
+        fprintf(stderr, "Failed to allocate memory for ScenarioTemplate values.\n");
+        exit(EXIT_FAILURE);
+    }
+    return values;
+}
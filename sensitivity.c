@@ -0,0 +1,272 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// One numeric parameter of the scenario that the analysis perturbs
+typedef struct SensitivityParameter {
+    char label[64];
+    int *value;         // Points into the loaded scenario, which every forked worker shares
+    int base;
+    int delta;          // How far the parameter is moved up and down
+} SensitivityParameter;
+
+// All of the parameters being perturbed; variant 0 is the unperturbed base,
+// variants 2k+1 and 2k+2 move parameter k up and down
+typedef struct SensitivityPlan {
+    SensitivityParameter *parameters;
+    int count;
+    int capacity;
+} SensitivityPlan;
+
+// The effect of one parameter on the run, used to rank the parameters
+typedef struct SensitivityRow {
+    const SensitivityParameter *parameter;
+    double time_effect;     // Relative change in time-to-destination between +delta and -delta
+    int oxygen_effect;      // Change in oxygen margin between +delta and -delta
+    const RunResult *up;
+    const RunResult *down;
+} SensitivityRow;
+
+static void plan_add(SensitivityPlan *plan, const char *owner, const char *field, int *value, double epsilon);
+static void sensitivity_setup(Manager *manager, int variant, void *context);
+static void sensitivity_run_lockstep(Manager *manager, SensitivityPlan *plan, int variant_count, RunResult *results);
+static int compare_rows(const void *a, const void *b);
+
+/**
+ * Ranks the scenario's parameters by how much they affect the run.
+ *
+ * Every system's processing time and consumed/produced amounts and every resource's
+ * capacity are moved up and down by `epsilon` (at least one unit), and all of the variants
+ * run in parallel. The optional warm-up runs once in this process; the variants are forked
+ * from its end state so none of them repeat it.
+ *
+ * With `lockstep` the variants instead run in virtual time on the lockstep engine,
+ * `LOCKSTEP_LANES` at a time in a single thread, starting from the loaded scenario.
+ *
+ * @param[in,out] manager    Pointer to the loaded `Manager`; its time limit applies to each variant.
+ * @param[in]     epsilon    Relative perturbation, e.g. 0.1 for +/-10%.
+ * @param[in]     warmup_ms  Milliseconds to run the base scenario before forking the variants.
+ * @param[in]     jobs       Largest number of variants running at once.
+ * @param[in]     lockstep   Non-zero to run the variants on the lockstep engine.
+ */
+void sensitivity_run(Manager *manager, double epsilon, int warmup_ms, int jobs, int lockstep) {
+    SensitivityPlan plan;
+    SensitivityRow *rows;
+    RunResult warmup, *results;
+    int variant_count, time_limit = manager->time_limit_ms;
+    double base_time;
+    int destination;
+
+    // Resolves the Distance resource the projected times are measured against
+    simulation_prepare(manager);
+
+    plan.count = 0;
+    plan.capacity = 2 * manager->system_array.size + manager->system_array.size + manager->resource_array.size;
+    plan.parameters = (SensitivityParameter *)malloc(plan.capacity * sizeof(SensitivityParameter));
+    if (plan.parameters == NULL) {
+        fprintf(stderr, "Failed to allocate memory for SensitivityPlan.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        System *system = manager->system_array.systems[i];
+        plan_add(&plan, system->name, "processing_time", &system->processing_time, epsilon);
+        if (system->consumed.resource != NULL) {
+            plan_add(&plan, system->name, "consumed", &system->consumed.amount, epsilon);
+        }
+        if (system->produced.resource != NULL) {
+            plan_add(&plan, system->name, "produced", &system->produced.amount, epsilon);
+        }
+    }
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        Resource *resource = manager->resource_array.resources[i];
+        plan_add(&plan, resource->name, "max_capacity", &resource->max_capacity, epsilon);
+    }
+
+    // Shared warm-up, the variants continue from where it stops
+    memset(&warmup, 0, sizeof(warmup));
+    manager->display = 0;
+    if (warmup_ms > 0 && lockstep) {
+        printf("Warm-up runs in real time, so it is skipped for lockstep variants.\n");
+    } else if (warmup_ms > 0) {
+        manager->time_limit_ms = warmup_ms;
+        simulation_run(manager, &warmup);
+        if (warmup.outcome != OUTCOME_TIME_LIMIT) {
+            printf("Base scenario ended during warm-up: %s after %lld ms.\n", outcome_name(warmup.outcome), warmup.elapsed_ms);
+            free(plan.parameters);
+            return;
+        }
+        simulation_resume(manager);
+        manager->time_limit_ms = time_limit;
+    }
+
+    variant_count = 1 + 2 * plan.count;
+    results = (RunResult *)malloc(variant_count * sizeof(RunResult));
+    rows = (SensitivityRow *)malloc(plan.count * sizeof(SensitivityRow));
+    if (results == NULL || rows == NULL) {
+        fprintf(stderr, "Failed to allocate memory for sensitivity results.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (lockstep) {
+        printf("Running %d variants (+/-%.0f%%) in lockstep, %d lanes at a time...\n", variant_count, epsilon * 100, LOCKSTEP_LANES);
+        sensitivity_run_lockstep(manager, &plan, variant_count, results);
+    } else {
+        printf("Running %d variants (+/-%.0f%%, %d at a time)...\n", variant_count, epsilon * 100, jobs);
+        runner_run_variants(manager, variant_count, jobs, sensitivity_setup, &plan, results);
+    }
+
+    destination = (manager->distance != NULL) ? manager->distance->max_capacity : 0;
+    base_time = run_time_to_destination(&results[0], warmup.elapsed_ms, destination);
+    for (int k = 0; k < plan.count; k++) {
+        const RunResult *up = &results[2 * k + 1];
+        const RunResult *down = &results[2 * k + 2];
+        double up_time = run_time_to_destination(up, warmup.elapsed_ms, destination);
+        double down_time = run_time_to_destination(down, warmup.elapsed_ms, destination);
+
+        rows[k].parameter = &plan.parameters[k];
+        rows[k].up = up;
+        rows[k].down = down;
+        rows[k].time_effect = (base_time > 0 && up_time > 0 && down_time > 0) ? (up_time - down_time) / base_time : 0.0;
+        rows[k].oxygen_effect = up->min_oxygen - down->min_oxygen;
+    }
+    qsort(rows, plan.count, sizeof(SensitivityRow), compare_rows);
+
+    printf("Base: %s, time to destination %.0f ms%s, oxygen margin %d\n",
+           outcome_name(results[0].outcome), base_time,
+           results[0].outcome == OUTCOME_DESTINATION ? "" : " (projected)",
+           (warmup_ms > 0 && warmup.min_oxygen < results[0].min_oxygen) ? warmup.min_oxygen : results[0].min_oxygen);
+    printf("%-32s %8s %8s %10s %10s  %s\n", "Parameter", "Base", "Delta", "Time", "Oxygen", "Outcomes (+/-)");
+    for (int k = 0; k < plan.count; k++) {
+        printf("%-32s %8d %8d %+9.1f%% %+10d  %s / %s\n",
+               rows[k].parameter->label,
+               rows[k].parameter->base,
+               rows[k].parameter->delta,
+               rows[k].time_effect * 100,
+               rows[k].oxygen_effect,
+               outcome_name(rows[k].up->outcome),
+               outcome_name(rows[k].down->outcome));
+    }
+
+    free(rows);
+    free(results);
+    free(plan.parameters);
+}
+
+/**
+ * Adds a parameter to the plan, perturbing it by `epsilon` of its value but by at least one.
+ *
+ * @param[in,out] plan     Pointer to the `SensitivityPlan`.
+ * @param[in]     owner    Name of the system or resource the parameter belongs to.
+ * @param[in]     field    Name of the parameter.
+ * @param[in]     value    Pointer to the parameter in the loaded scenario.
+ * @param[in]     epsilon  Relative perturbation.
+ */
+static void plan_add(SensitivityPlan *plan, const char *owner, const char *field, int *value, double epsilon) {
+    SensitivityParameter *parameter = &plan->parameters[plan->count++];
+
+    snprintf(parameter->label, sizeof(parameter->label), "%s %s", owner, field);
+    parameter->value = value;
+    parameter->base = *value;
+    parameter->delta = (int)lround(fabs(*value * epsilon));
+    if (parameter->delta < 1) {
+        parameter->delta = 1;
+    }
+}
+
+/**
+ * `VariantSetup` for the analysis, applies the variant's perturbation in the forked worker.
+ *
+ * @param[in,out] manager  Pointer to the worker's copy of the `Manager`.
+ * @param[in]     variant  The variant this worker runs.
+ * @param[in]     context  Pointer to the `SensitivityPlan`.
+ */
+static void sensitivity_setup(Manager *manager, int variant, void *context) {
+    SensitivityPlan *plan = (SensitivityPlan *)context;
+    SensitivityParameter *parameter;
+
+    (void)manager;
+    if (variant == 0) {
+        return;
+    }
+
+    parameter = &plan->parameters[(variant - 1) / 2];
+    if (variant % 2 == 1) {
+        *parameter->value = parameter->base + parameter->delta;
+    } else {
+        *parameter->value = parameter->base - parameter->delta;
+        if (*parameter->value < 0) {
+            *parameter->value = 0;
+        }
+    }
+}
+
+/**
+ * Runs every variant on the lockstep engine, filling the lanes one batch at a time.
+ *
+ * Each lane is loaded by applying its variant's perturbation to the scenario, copying the
+ * scenario into the lane and putting the parameter back.
+ *
+ * @param[in,out] manager        Pointer to the loaded `Manager`.
+ * @param[in]     plan           Pointer to the `SensitivityPlan`.
+ * @param[in]     variant_count  Number of variants.
+ * @param[out]    results        Receives one result per variant, times in virtual milliseconds.
+ */
+static void sensitivity_run_lockstep(Manager *manager, SensitivityPlan *plan, int variant_count, RunResult *results) {
+    ScenarioTemplate scenario;
+    LockstepEngine engine;
+    long long max_ticks = (manager->time_limit_ms > 0) ? manager->time_limit_ms : LOCKSTEP_MAX_TICKS;
+    long long lane_ticks = 0;
+    struct timespec start, end;
+    double elapsed_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    scenario_template_init(&scenario, manager);
+    for (int first = 0; first < variant_count; first += LOCKSTEP_LANES) {
+        int lanes = (variant_count - first < LOCKSTEP_LANES) ? variant_count - first : LOCKSTEP_LANES;
+
+        lockstep_init(&engine, &scenario, lanes);
+        for (int lane = 0; lane < lanes; lane++) {
+            int variant = first + lane;
+            sensitivity_setup(manager, variant, plan);
+            lockstep_load_lane(&engine, lane, manager);
+            if (variant > 0) {
+                SensitivityParameter *parameter = &plan->parameters[(variant - 1) / 2];
+                *parameter->value = parameter->base;
+            }
+        }
+
+        lockstep_run(&engine, max_ticks);
+        for (int lane = 0; lane < lanes; lane++) {
+            lockstep_result(&engine, lane, &results[first + lane]);
+            lane_ticks += results[first + lane].elapsed_ms;
+        }
+        lockstep_clean(&engine);
+    }
+    scenario_template_clean(&scenario);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed_ms = timespec_elapsed_ns(&start, &end) / 1e6;
+    printf("Simulated %lld virtual ms across all variants in %.1f ms\n", lane_ticks, elapsed_ms);
+}
+
+/**
+ * Orders rows by the size of their effect on time-to-destination, then on oxygen margin.
+ *
+ * @param[in] a  Pointer to the first `SensitivityRow`.
+ * @param[in] b  Pointer to the second `SensitivityRow`.
+ * @return       Negative if `a` should come first, positive if `b` should.
+ */
+static int compare_rows(const void *a, const void *b) {
+    const SensitivityRow *row_a = (const SensitivityRow *)a;
+    const SensitivityRow *row_b = (const SensitivityRow *)b;
+    double time_a = fabs(row_a->time_effect), time_b = fabs(row_b->time_effect);
+
+    if (time_a != time_b) {
+        return (time_a < time_b) ? 1 : -1;
+    }
+    return abs(row_b->oxygen_effect) - abs(row_a->oxygen_effect);
+}
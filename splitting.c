@@ -0,0 +1,175 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+// Rare-event splitting: instead of running the whole scenario many times and counting how
+// often Oxygen runs out, the way down to zero is cut into levels. Every level runs the same
+// number of particles (lanes of the lockstep engine), each continued from a randomly chosen
+// particle that crossed the previous level. The probability of running out is the product of
+// the fractions that cross each level, so no particle is ever wasted re-running the common
+// part of a trajectory.
+
+// States of the particles that crossed a level; they all share one ScenarioTemplate
+typedef struct SplittingPool {
+    ScenarioState *states;
+    int count;
+} SplittingPool;
+
+static int splitting_stage(LockstepEngine *engine, const SplittingPool *parents, SplittingPool *hits, int particles,
+                           int stage, unsigned int seed, long long max_ticks, long long *lane_ticks);
+
+/**
+ * Estimates the probability that Oxygen runs out, using fixed-effort multilevel splitting.
+ *
+ * Thresholds are spread evenly between the starting amount of Oxygen and zero. Each stage
+ * runs `particles` copies of the scenario on the lockstep engine, with random jitter on the
+ * processing times, until Oxygen falls to the next threshold or the run ends some other way.
+ * The crossings are saved and the next stage restarts from them.
+ *
+ * @param[in,out] manager         Pointer to the loaded `Manager`; its time limit applies to each particle.
+ * @param[in]     particles       Particles per level, rounded up to a multiple of `LOCKSTEP_LANES`.
+ * @param[in]     levels          Number of intermediate thresholds.
+ * @param[in]     jitter_percent  Largest random change of each processing time, in percent.
+ * @param[in]     seed            Seed for the jitter and for choosing which crossings to continue.
+ */
+void splitting_run(Manager *manager, int particles, int levels, int jitter_percent, unsigned int seed) {
+    ScenarioTemplate scenario;
+    LockstepEngine engine;
+    SplittingPool parents, hits;
+    ScenarioState *start_state, *pools[2];
+    long long max_ticks = (manager->time_limit_ms > 0) ? manager->time_limit_ms : LOCKSTEP_MAX_TICKS;
+    int start_oxygen, floor, previous_floor, stage = 0, particles_run = 0;
+    long long lane_ticks = 0;
+    double probability = 1.0, relative_variance = 0.0;
+    struct timespec start, end;
+    double elapsed_ms;
+
+    simulation_prepare(manager);
+    if (manager->oxygen == NULL) {
+        printf("The scenario has no Oxygen resource to estimate depletion of.\n");
+        return;
+    }
+    if (particles <= 0) {
+        return;
+    }
+    particles = (particles + LOCKSTEP_LANES - 1) / LOCKSTEP_LANES * LOCKSTEP_LANES;
+    if (levels < 0) {
+        levels = 0;
+    }
+
+    // Particles only hold their state, the scenario itself is shared by all of them
+    scenario_template_init(&scenario, manager);
+    lockstep_init(&engine, &scenario, LOCKSTEP_LANES);
+    lockstep_set_jitter(&engine, jitter_percent);
+    start_state = scenario_state_array(&scenario, 1);
+    pools[0] = scenario_state_array(&scenario, particles);
+    pools[1] = scenario_state_array(&scenario, particles);
+    parents.states = start_state;
+    parents.count = 1;
+
+    start_oxygen = scenario.initial_amount[scenario.oxygen];
+    printf("Splitting %d particles per level over %d thresholds, jitter +/-%d%%, %zu bytes per particle\n",
+           particles, levels, jitter_percent, scenario_state_size(&scenario));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    previous_floor = start_oxygen;
+    for (int level = 1; level <= levels + 1; level++) {
+        double fraction;
+
+        // The last stage runs all the way to depletion; thresholds too close together are skipped
+        floor = (level <= levels) ? (int)((long long)start_oxygen * (levels + 1 - level) / (levels + 1)) : -1;
+        if (floor >= previous_floor || floor == 0) {
+            continue;
+        }
+
+        engine.oxygen_floor = floor;
+        hits.states = pools[stage % 2];
+        hits.count = splitting_stage(&engine, &parents, &hits, particles, stage, seed, max_ticks, &lane_ticks);
+        particles_run += particles;
+        fraction = (double)hits.count / particles;
+        if (floor >= 0) {
+            printf("  Oxygen <= %-6d %6d / %d crossed (%.4f)\n", floor, hits.count, particles, fraction);
+        } else {
+            printf("  Oxygen depleted %6d / %d crossed (%.4f)\n", hits.count, particles, fraction);
+        }
+
+        probability *= fraction;
+        if (hits.count == 0) {
+            break;
+        }
+        relative_variance += (1.0 - fraction) / (particles * fraction);
+
+        parents = hits;
+        previous_floor = floor;
+        stage++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ms = timespec_elapsed_ns(&start, &end) / 1e6;
+
+    if (probability > 0.0) {
+        double relative_error = sqrt(relative_variance);
+
+        printf("P(oxygen depleted) ~ %.3e (relative error ~ %.0f%%)\n", probability, relative_error * 100);
+        if (relative_error > 0.0 && probability < 1.0) {
+            printf("Plain Monte Carlo would need ~%.3g full runs for the same relative error; splitting ran %d particles\n",
+                   (1.0 - probability) / (probability * relative_variance), particles_run);
+        }
+    } else {
+        printf("P(oxygen depleted) < %.3e (no particle crossed every level; use more particles or levels)\n",
+               1.0 / particles);
+    }
+    printf("Simulated %lld virtual ms across all particles in %.1f ms\n", lane_ticks, elapsed_ms);
+
+    free(start_state);
+    free(pools[0]);
+    free(pools[1]);
+    lockstep_clean(&engine);
+    scenario_template_clean(&scenario);
+}
+
+/**
+ * Runs one level: every particle continues a random crossing of the previous level.
+ *
+ * @param[in,out] engine      Pointer to the `LockstepEngine`, with the level's Oxygen floor set.
+ * @param[in]     parents     States to continue from, chosen at random for each particle.
+ * @param[out]    hits        Receives the states of the particles that cross the floor.
+ * @param[in]     particles   Particles to run, a multiple of `LOCKSTEP_LANES`.
+ * @param[in]     stage       Number of the level, used to give each particle its own seed.
+ * @param[in]     seed        Base seed.
+ * @param[in]     max_ticks   Time limit of each particle in virtual milliseconds.
+ * @param[in,out] lane_ticks  Accumulates the virtual milliseconds simulated.
+ * @return                    Number of particles that crossed the floor.
+ */
+static int splitting_stage(LockstepEngine *engine, const SplittingPool *parents, SplittingPool *hits, int particles,
+                           int stage, unsigned int seed, long long max_ticks, long long *lane_ticks) {
+    const ScenarioTemplate *scenario = engine->scenario;
+    unsigned int choice = seed ^ (unsigned int)(stage * 7919);
+    int count = 0;
+
+    for (int first = 0; first < particles; first += LOCKSTEP_LANES) {
+        int started[LOCKSTEP_LANES];
+
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            int parent = rand_r(&choice) % parents->count;
+
+            lockstep_seed_lane(engine, lane, seed + (uint32_t)stage * 0x9E3779B9u + (uint32_t)(first + lane));
+            lockstep_restore_lane(engine, lane, scenario_state_at(scenario, parents->states, parent));
+            started[lane] = engine->elapsed[lane];
+        }
+
+        lockstep_run(engine, max_ticks);
+        for (int lane = 0; lane < LOCKSTEP_LANES; lane++) {
+            int outcome = engine->outcome[lane];
+
+            // Running out of Oxygen crosses every threshold at once
+            if (outcome == OUTCOME_NO_OXYGEN || (engine->oxygen_floor >= 0 && outcome == OUTCOME_THRESHOLD)) {
+                lockstep_save_lane(engine, lane, scenario_state_at(scenario, hits->states, count));
+                count++;
+            }
+            *lane_ticks += engine->elapsed[lane] - started[lane];
+        }
+    }
+    return count;
+}
@@ -0,0 +1,212 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Stall detection: ending runs that can no longer make progress */
+
+// After every manager pass the systems' conversion counters are summed; that is the only
+// cost while the run moves. Once the sum has not changed for `stall_periods` periods (a
+// period being the retry wait plus the slowest system's processing time), the wait-for
+// graph is built: a system waiting to consume waits on its input's producers, one waiting
+// to store waits on its output's consumers. A system is deadlocked if everything it waits
+// on is deadlocked too (the largest such set is found by removing systems that wait on a
+// free one until nothing changes). Either way the run is ended with `OUTCOME_STALLED`:
+// if some systems are not blocked, they are running without completing anything.
+
+static long long stall_progress(const Manager *manager);
+static int stall_waiting(const System *system, Resource **resource, int *full);
+static int stall_find_blocked(const Manager *manager, int *blocked);
+static void stall_report(const Manager *manager, const int *blocked, int deadlocked, long long idle_ms);
+
+/**
+ * Starts watching a run for stalls, called when the run starts.
+ *
+ * @param[in,out] manager  Pointer to the prepared `Manager`, with `start` set.
+ */
+void stall_reset(Manager *manager) {
+    int slowest = 0;
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        const System *system = manager->system_array.systems[i];
+        int period = system->processing_time + system->processing_spread;
+
+        if (period > slowest) {
+            slowest = period;
+        }
+    }
+    manager->stall_period_ms = SYSTEM_WAIT_TIME + slowest;
+    manager->stall_progress = -1;
+    manager->stall_since = manager->start;
+}
+
+/**
+ * Ends the run with `OUTCOME_STALLED` once no system has made progress for too long.
+ *
+ * Called after every manager pass. Does nothing if `stall_periods` is zero.
+ *
+ * @param[in,out] manager  Pointer to the running `Manager`.
+ */
+void stall_check(Manager *manager) {
+    long long progress = stall_progress(manager);
+    struct timespec now;
+    long long idle_ms;
+    int blocked[manager->system_array.size > 0 ? manager->system_array.size : 1];
+    int deadlocked;
+
+    if (manager->stall_periods <= 0 || !atomic_load_explicit(&manager->simulation_running, memory_order_relaxed)) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (progress != manager->stall_progress) {
+        manager->stall_progress = progress;
+        manager->stall_since = now;
+        return;
+    }
+
+    idle_ms = timespec_elapsed_ns(&manager->stall_since, &now) / 1000000LL;
+    if (idle_ms < manager->stall_periods * manager->stall_period_ms) {
+        return;
+    }
+
+    deadlocked = stall_find_blocked(manager, blocked);
+    if (manager->display) {
+        stall_report(manager, blocked, deadlocked, idle_ms);
+    }
+    manager_terminate(manager, OUTCOME_STALLED);
+}
+
+/**
+ * Sums the conversions every system completed this run.
+ *
+ * @param[in] manager  Pointer to the `Manager`.
+ * @return             The sum; it only changes when some system makes progress.
+ */
+static long long stall_progress(const Manager *manager) {
+    long long progress = 0;
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        progress += atomic_load_explicit(&manager->system_array.systems[i]->conversions, memory_order_relaxed);
+    }
+    return progress;
+}
+
+/**
+ * Finds the resource a system is waiting on, from its last reports.
+ *
+ * @param[in]  system    Pointer to the `System`.
+ * @param[out] resource  Receives the resource waited on.
+ * @param[out] full      Receives non-zero if the system waits to store into a full resource,
+ *                       zero if it waits for its input.
+ * @return               Non-zero if the system is waiting.
+ */
+static int stall_waiting(const System *system, Resource **resource, int *full) {
+    // Each field is loaded once, so the checks below agree with each other
+    int stored = atomic_load_explicit(&system->amount_stored, memory_order_relaxed);
+    int consume_report = atomic_load_explicit(&system->consume_report, memory_order_relaxed);
+    int store_report = atomic_load_explicit(&system->store_report, memory_order_relaxed);
+
+    if (stored == 0 && consume_report != STATUS_OK && system->consumed.resource != NULL) {
+        *resource = system->consumed.resource;
+        *full = 0;
+        return 1;
+    }
+    if (stored > 0 && store_report != STATUS_OK && system->produced.resource != NULL) {
+        *resource = system->produced.resource;
+        *full = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Finds the deadlocked systems in the wait-for graph.
+ *
+ * Starts from every waiting system and removes those waiting on a resource that some
+ * system outside the set could change, until no more can be removed.
+ *
+ * @param[in]  manager  Pointer to the `Manager`.
+ * @param[out] blocked  Receives, per system, non-zero if it is deadlocked.
+ * @return              Non-zero if every running system is deadlocked.
+ */
+static int stall_find_blocked(const Manager *manager, int *blocked) {
+    int count = manager->system_array.size;
+    int changed = 1, all = 1;
+
+    for (int i = 0; i < count; i++) {
+        Resource *resource;
+        int full;
+
+        blocked[i] = stall_waiting(manager->system_array.systems[i], &resource, &full);
+    }
+
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < count; i++) {
+            Resource *resource;
+            int full;
+
+            if (!blocked[i] || !stall_waiting(manager->system_array.systems[i], &resource, &full)) {
+                continue;
+            }
+            for (int j = 0; j < count; j++) {
+                const System *other = manager->system_array.systems[j];
+                Resource *changes = full ? other->consumed.resource : other->produced.resource;
+
+                if (changes == resource && !blocked[j] && atomic_load_explicit(&other->status, memory_order_relaxed) != TERMINATE
+                    && atomic_load_explicit(&other->status, memory_order_relaxed) != DISABLED) {
+                    blocked[i] = 0;
+                    changed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        int status = atomic_load_explicit(&manager->system_array.systems[i]->status, memory_order_relaxed);
+
+        if (!blocked[i] && status != TERMINATE && status != DISABLED) {
+            all = 0;
+        }
+    }
+    return all;
+}
+
+/**
+ * Prints the wait-for graph of a stalled run.
+ *
+ * @param[in] manager     Pointer to the `Manager`.
+ * @param[in] blocked     Per system, non-zero if it is deadlocked.
+ * @param[in] deadlocked  Non-zero if every running system is deadlocked.
+ * @param[in] idle_ms     Milliseconds since the last progress.
+ */
+static void stall_report(const Manager *manager, const int *blocked, int deadlocked, long long idle_ms) {
+    printf("\nStalled: no system completed a conversion in %lld ms (%s).\n", idle_ms,
+           deadlocked ? "deadlock, every system waits on another" : "livelock, some systems are not blocked");
+
+    for (int i = 0; i < manager->system_array.size; i++) {
+        const System *system = manager->system_array.systems[i];
+        Resource *resource;
+        int full, listed = 0;
+
+        if (!stall_waiting(system, &resource, &full)) {
+            printf("  %-14s not waiting on a resource\n", system->name);
+            continue;
+        }
+
+        printf("  %-14s %s %s %s (%d of %d, needs %d) <-", system->name, blocked[i] ? "blocked" : "waits",
+               full ? "to store into" : "for", resource->name, atomic_load(&resource->amount), resource->max_capacity,
+               full ? atomic_load_explicit(&system->amount_stored, memory_order_relaxed) : system->consumed.amount);
+        for (int j = 0; j < manager->system_array.size; j++) {
+            const System *other = manager->system_array.systems[j];
+
+            if ((full ? other->consumed.resource : other->produced.resource) == resource) {
+                printf(" %s%s", other->name, blocked[j] ? " (blocked)" : "");
+                listed = 1;
+            }
+        }
+        printf("%s\n", listed ? "" : (full ? " no consumer" : " no producer"));
+    }
+}
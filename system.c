@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 // Helper functions just used by this C file to clean up our code
 // Using static means they can't get linked into other files
@@ -10,6 +12,8 @@
 static int system_convert(System *);
 static void system_simulate_process_time(System *);
 static int system_store_resources(System *);
+static void system_sleep_until(System *system, const struct timespec *deadline);
+static void system_set_activity(System *system, int activity);
 
 /**
  * Creates a new `System` object.
@@ -25,6 +29,47 @@ static int system_store_resources(System *);
  * @param[in]  event_queue     Pointer to the `EventQueue` for event handling.
  * @return                     STATUS_OK on success, STATUS_FAILURE on error.
  */
+void system_create(System **system, const char *name, ResourceAmount consumed, ResourceAmount produced, int processing_time, EventQueue *event_queue) {
+    // Allocate memory for the System structure
+    *system = (System *)malloc(sizeof(System));
+    if (*system == NULL) {
+        fprintf(stderr, "Failed to allocate memory for System.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Allocate memory for the name and copy it
+    (*system)->name = (char *)malloc(strlen(name) + 1);
+    if ((*system)->name == NULL) {
+        fprintf(stderr, "Failed to allocate memory for System name.\n");
+        free(*system);
+        exit(EXIT_FAILURE);
+    }
+    strcpy((*system)->name, name);
+
+    // Initialize the fields
+    (*system)->consumed = consumed;
+    (*system)->produced = produced;
+    atomic_init(&(*system)->amount_stored, 0);
+    (*system)->processing_time = processing_time;
+    (*system)->processing_distribution = PROCESSING_FIXED;
+    (*system)->processing_spread = 0;
+    random_stream_init(&(*system)->random, 0, 0);
+    atomic_init(&(*system)->consume_report, STATUS_OK);
+    atomic_init(&(*system)->store_report, STATUS_OK);
+    atomic_init(&(*system)->status, STANDARD);
+    (*system)->id = -1;
+    atomic_init(&(*system)->heartbeat, 0);
+    atomic_init(&(*system)->activity, ACTIVITY_STARTING);
+    (*system)->event_queue = event_queue;
+    system_reset_schedule(*system);
+
+    (*system)->event_stage = (EventStage *)malloc(sizeof(EventStage));
+    if ((*system)->event_stage == NULL) {
+        fprintf(stderr, "Failed to allocate memory for System event stage.\n");
+        exit(EXIT_FAILURE);
+    }
+    event_stage_init((*system)->event_stage, event_queue);
+}
 
  /**
   * Thread function for individual systems.
@@ -32,25 +77,19 @@ static int system_store_resources(System *);
   * @param[in] arg Pointer to the System struct.
   * @return    NULL
   */
-extern sem_t resource_sem; // Semaphore for synchronizing resource access
-
  void* system_thread(void* arg) {
      System* system = (System*)arg;
 
-     while (system->status != TERMINATE) {
-         // Synchronize access to shared resources
-         sem_wait(&resource_sem);
-
-         // Call system_run() to perform system-specific operations
+     flight_thread_start(system->name);
+     system_reset_schedule(system);
+     while (atomic_load_explicit(&system->status, memory_order_relaxed) != TERMINATE) {
+         // Resources and the event queue synchronize themselves, so systems run concurrently;
+         // processing sleeps until absolute deadlines, so no extra pause is needed between steps
          system_run(system);
-
-         sem_post(&resource_sem);
-
-         // Sleep for a short duration to simulate time between operations
-         sleep(1);
      }
 
      printf("System %s terminating.\n", system->name);
+     flight_thread_stop();
      pthread_exit(NULL);
  }
 
@@ -73,46 +112,136 @@ void system_destroy(System *system) {
     }
 
     // Free the System object itself
+    free(system->event_stage);
     free(system);
 }
 
+/**
+ * Makes a `System`'s processing times random around its `processing_time`.
+ *
+ * Times are drawn from the system's own random stream, see `simulation_seed`.
+ *
+ * @param[in,out] system        Pointer to the `System`.
+ * @param[in]     distribution  One of the `PROCESSING_*` distributions.
+ * @param[in]     spread        Half-width (uniform) or standard deviation (normal) in milliseconds.
+ */
+void system_set_processing(System *system, int distribution, int spread) {
+    system->processing_distribution = distribution;
+    system->processing_spread = (spread > 0) ? spread : 0;
+}
+
+/**
+ * Starts a `System`'s schedule, lag and time accounting over, e.g. at the start of a run.
+ *
+ * Must be called from the thread that runs the system, whose CPU clock it reads.
+ *
+ * @param[in,out] system  Pointer to the `System`.
+ */
+void system_reset_schedule(System *system) {
+    clock_gettime(CLOCK_MONOTONIC, &system->run_start);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &system->cpu_start);
+    system->on_schedule = 0;
+    system->blocked_base = resource_blocked_ns();
+    atomic_store_explicit(&system->deadline_ns, timespec_to_ns(&system->run_start), memory_order_relaxed);
+    atomic_store_explicit(&system->conversions, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->nominal_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->lag_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->max_lag_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->step_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->cpu_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->sleep_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->starved_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&system->blocked_ns, 0, memory_order_relaxed);
+}
+
+/**
+ * How fast a `System` has converted compared to its nominal rate, from the start of the
+ * run to its last step.
+ *
+ * Each conversion is due after `processing_time` adjusted for the status it ran at (half
+ * as long when FAST, twice as long when SLOW), so a FAST system on schedule is at 1.0 too.
+ *
+ * @param[in] system  Pointer to the `System`.
+ * @return            Conversions done over conversions due, 1.0 when exactly on schedule.
+ */
+double system_rate(const System *system) {
+    long long elapsed = atomic_load_explicit(&system->step_ns, memory_order_relaxed);
+    long long nominal = atomic_load_explicit(&system->nominal_ns, memory_order_relaxed);
+
+    if (nominal <= 0 || elapsed <= 0) {
+        return 1.0;
+    }
+    return (double)nominal / elapsed;
+}
+
 /**
  * Runs the main loop for a `System`.
  *
  * This function manages the lifecycle of a system, including resource conversion,
- * processing time simulation, and resource storage. It generates events based on
- * the success or failure of these operations.
+ * processing time simulation, and resource storage. It generates an event when
+ * consuming or storing starts failing, or fails differently, but not on every retry.
+ * Events from the step, including threshold events of the resources it touches, are
+ * staged and published together at the end of the step (HIGH priority ones at once).
  *
  * @param[in,out] system  Pointer to the `System` to run.
  */
 void system_run(System *system) {
     Event event;
+    struct timespec retry, now, cpu;
     int result_status;
 
-    if (system->amount_stored == 0) {
+    event_stage_bind(system->event_stage);
+
+    if (atomic_load_explicit(&system->amount_stored, memory_order_relaxed) == 0) {
         // Need to convert resources (consume and process)
         result_status = system_convert(system);
 
-        if (result_status != STATUS_OK) {
+        // Report only when the outcome changes, not on every retry
+        if (result_status != STATUS_OK && result_status != atomic_load_explicit(&system->consume_report, memory_order_relaxed)) {
             // Report that resources were out / insufficient
             event_init(&event, system, system->consumed.resource, result_status, PRIORITY_HIGH, system->consumed.amount);
-            event_queue_push(system->event_queue, &event);
-            // Sleep to prevent looping too frequently and spamming with events
-            usleep(SYSTEM_WAIT_TIME * 1000);
+            event_stage_push(system->event_stage, &event);
+            // No extra sleep needed, the conversion already waited SYSTEM_WAIT_TIME for a producer
         }
+        atomic_store_explicit(&system->consume_report, result_status, memory_order_relaxed);
     }
 
-    if (system->amount_stored  > 0) {
+    if (atomic_load_explicit(&system->amount_stored, memory_order_relaxed) > 0) {
         // Attempt to store the produced resources
         result_status = system_store_resources(system);
 
         if (result_status != STATUS_OK) {
-            event_init(&event, system, system->produced.resource, result_status, PRIORITY_LOW, system->produced.amount);
-            event_queue_push(system->event_queue, &event);
-            // Sleep to prevent looping too frequently and spamming with events
-            usleep(SYSTEM_WAIT_TIME * 1000);
+            if (result_status != atomic_load_explicit(&system->store_report, memory_order_relaxed)) {
+                event_init(&event, system, system->produced.resource, result_status, PRIORITY_LOW, system->produced.amount);
+                // A shed report is offered again on the next retry
+                if (!event_stage_push(system->event_stage, &event)) {
+                    result_status = atomic_load_explicit(&system->store_report, memory_order_relaxed);
+                }
+            }
+            // Publish before sleeping so the manager is not kept waiting
+            system_set_activity(system, ACTIVITY_PUBLISHING);
+            event_stage_flush(system->event_stage);
+            system->on_schedule = 0;
+            // Sleep to prevent looping too frequently
+            clock_gettime(CLOCK_MONOTONIC, &retry);
+            timespec_add_ms(&retry, SYSTEM_WAIT_TIME);
+            system_set_activity(system, ACTIVITY_RETRYING);
+            system_sleep_until(system, &retry);
         }
+        atomic_store_explicit(&system->store_report, result_status, memory_order_relaxed);
     }
+
+    system_set_activity(system, ACTIVITY_PUBLISHING);
+    event_stage_flush(system->event_stage);
+    event_stage_bind(NULL);
+
+    // Time accounting, read by the manager's display and the exit report
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    atomic_store_explicit(&system->step_ns, timespec_elapsed_ns(&system->run_start, &now), memory_order_relaxed);
+    atomic_store_explicit(&system->cpu_ns, timespec_elapsed_ns(&system->cpu_start, &cpu), memory_order_relaxed);
+    atomic_store_explicit(&system->blocked_ns, resource_blocked_ns() - system->blocked_base, memory_order_relaxed);
+    atomic_fetch_add_explicit(&system->heartbeat, 1, memory_order_relaxed);
 }
 
 /**
@@ -125,6 +254,7 @@ void system_run(System *system) {
  * @return                `STATUS_OK` if successful, or an error status code.
  */
 static int system_convert(System *system) {
+    struct timespec start, end;
     int status;
     Resource *consumed_resource = system->consumed.resource;
     int amount_consumed = system->consumed.amount;
@@ -133,12 +263,17 @@ static int system_convert(System *system) {
     if (consumed_resource == NULL) {
         status = STATUS_OK;
     } else {
-        // Attempt to consume the required resources
-        if (consumed_resource->amount >= amount_consumed) {
-            consumed_resource->amount -= amount_consumed;
-            status = STATUS_OK;
-        } else {
-            status = (consumed_resource->amount == 0) ? STATUS_EMPTY : STATUS_INSUFFICIENT;
+        // Attempt to consume the required resources, waiting briefly for a producer to hand them over
+        system_set_activity(system, ACTIVITY_CONSUMING);
+        status = resource_consume(consumed_resource, amount_consumed);
+        if (status != STATUS_OK) {
+            // Time spent starved is not lag, the conversion starts a new schedule
+            system->on_schedule = 0;
+            system_set_activity(system, ACTIVITY_WAITING);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            status = resource_consume_wait(consumed_resource, amount_consumed, SYSTEM_WAIT_TIME);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            atomic_fetch_add_explicit(&system->starved_ns, timespec_elapsed_ns(&start, &end), memory_order_relaxed);
         }
     }
 
@@ -146,9 +281,9 @@ static int system_convert(System *system) {
         system_simulate_process_time(system);
 
         if (system->produced.resource != NULL) {
-            system->amount_stored += system->produced.amount;
+            atomic_fetch_add_explicit(&system->amount_stored, system->produced.amount, memory_order_relaxed);
         } else {
-            system->amount_stored = 0;
+            atomic_store_explicit(&system->amount_stored, 0, memory_order_relaxed);
         }
     }
 
@@ -158,28 +293,85 @@ static int system_convert(System *system) {
 /**
  * Simulates the processing time for a `System`.
  *
- * Adjusts the processing time based on the system's current status (e.g., SLOW, FAST)
- * and sleeps for the adjusted time to simulate processing.
+ * Draws the processing time from the system's distribution, adjusts it based on the
+ * system's current status (e.g., SLOW, FAST) and sleeps until the conversion's deadline.
+ * While a system converts back to back, each deadline is the previous one plus the
+ * processing time, so time spent consuming, storing and waking up does not add up: a late
+ * conversion is followed by shorter sleeps until the system is back on schedule. How late
+ * each conversion finished is recorded as the system's lag.
  *
- * @param[in] system  Pointer to the `System` whose processing time is being simulated.
+ * @param[in,out] system  Pointer to the `System` whose processing time is being simulated.
  */
 static void system_simulate_process_time(System *system) {
-    int adjusted_processing_time;
+    int processing_time = random_processing_time(&system->random, system->processing_distribution,
+                                                 system->processing_time, system->processing_spread);
+    int adjusted_processing_time, nominal_time;
+    long long deadline = atomic_load_explicit(&system->deadline_ns, memory_order_relaxed), lag;
+    struct timespec wake, now;
 
     // Adjust based on the current system status modifier
-    switch (system->status) {
+    switch (atomic_load_explicit(&system->status, memory_order_relaxed)) {
         case SLOW:
-            adjusted_processing_time = system->processing_time * 2;
+            adjusted_processing_time = processing_time * 2;
+            nominal_time = system->processing_time * 2;
             break;
         case FAST:
-            adjusted_processing_time = system->processing_time / 2;
+            adjusted_processing_time = processing_time / 2;
+            nominal_time = system->processing_time / 2;
             break;
         default:
-            adjusted_processing_time = system->processing_time;
+            adjusted_processing_time = processing_time;
+            nominal_time = system->processing_time;
+    }
+
+    // Chain the deadline from the previous one, or start from now after a stall
+    if (!system->on_schedule) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        deadline = timespec_to_ns(&now);
+        system->on_schedule = 1;
+    }
+    deadline += adjusted_processing_time * 1000000LL;
+    atomic_store_explicit(&system->deadline_ns, deadline, memory_order_relaxed);
+
+    system_set_activity(system, ACTIVITY_PROCESSING);
+    timespec_from_ns(&wake, deadline);
+    system_sleep_until(system, &wake);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lag = timespec_to_ns(&now) - deadline;
+    atomic_store_explicit(&system->lag_ns, lag, memory_order_relaxed);
+    if (lag > atomic_load_explicit(&system->max_lag_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&system->max_lag_ns, lag, memory_order_relaxed);
     }
+    atomic_fetch_add_explicit(&system->nominal_ns, nominal_time * 1000000LL, memory_order_relaxed);
+    atomic_fetch_add_explicit(&system->conversions, 1, memory_order_relaxed);
+}
 
-    // Sleep for the required time
-    usleep(adjusted_processing_time * 1000);
+/**
+ * Notes what the system is about to do, for the watchdog's reports.
+ *
+ * @param[in,out] system    Pointer to the `System`.
+ * @param[in]     activity  One of the `ACTIVITY_*` codes.
+ */
+static void system_set_activity(System *system, int activity) {
+    atomic_store_explicit(&system->activity, activity, memory_order_relaxed);
+}
+
+/**
+ * Sleeps until an absolute `CLOCK_MONOTONIC` time, returning at once if it has passed.
+ *
+ * @param[in,out] system    Pointer to the `System`, whose sleep time is accumulated.
+ * @param[in]     deadline  The time to wake up.
+ */
+static void system_sleep_until(System *system, const struct timespec *deadline) {
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+        // Interrupted by a signal, keep sleeping towards the same deadline
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    atomic_fetch_add_explicit(&system->sleep_ns, timespec_elapsed_ns(&start, &end), memory_order_relaxed);
 }
 
 /**
@@ -194,30 +386,20 @@ static void system_simulate_process_time(System *system) {
  */
 static int system_store_resources(System *system) {
     Resource *produced_resource = system->produced.resource;
-    int available_space, amount_to_store;
+    int amount_stored = atomic_load_explicit(&system->amount_stored, memory_order_relaxed);
 
     // We can always proceed if there's nothing to store
-    if (produced_resource == NULL || system->amount_stored == 0) {
-        system->amount_stored = 0;
+    if (produced_resource == NULL || amount_stored == 0) {
+        atomic_store_explicit(&system->amount_stored, 0, memory_order_relaxed);
         return STATUS_OK;
     }
 
-    amount_to_store = system->amount_stored;
-
-    // Calculate available space
-    available_space = produced_resource->max_capacity - produced_resource->amount;
-
-    if (available_space >= amount_to_store) {
-        // Store all produced resources
-        produced_resource->amount += amount_to_store;
-        system->amount_stored = 0;
-    } else if (available_space > 0) {
-        // Store as much as possible
-        produced_resource->amount += available_space;
-        system->amount_stored = amount_to_store - available_space;
-    }
+    // Store as much as the resource has room for, keeping the rest for later
+    system_set_activity(system, ACTIVITY_STORING);
+    amount_stored -= resource_store(produced_resource, amount_stored);
+    atomic_store_explicit(&system->amount_stored, amount_stored, memory_order_relaxed);
 
-    if (system->amount_stored != 0) {
+    if (amount_stored != 0) {
         return STATUS_CAPACITY;
     }
 
@@ -293,6 +475,7 @@ void system_array_add(SystemArray *array, System *system) {
         array->capacity = new_capacity;
     }
 
-    // Add the new system
+    // Add the new system, its index becomes its id
+    system->id = (int)array->size;
     array->systems[array->size++] = system;
 }
@@ -0,0 +1,103 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Event trace: every event the manager handles, appended to a file as it is handled */
+
+// The trace is written by whichever thread runs the manager's pass, one at a time, through
+// the shared OutputWriter. Tracing an event is a clock read and a copy into the stream's
+// current page; the disk is only touched by the writer's own thread. Records are
+// compressed on the way, see trace_encode: a run repeats the same few (system, resource,
+// status) tuples, so most records shrink to a slot byte and a short time delta.
+
+static void trace_write_name(EventTrace *trace, const char *name);
+
+/**
+ * Creates a trace file and writes its header and the scenario's names.
+ *
+ * @param[out]    trace    Pointer to the `EventTrace` to open.
+ * @param[in,out] writer   Pointer to the `OutputWriter` the trace is written with.
+ * @param[in]     manager  Pointer to the loaded `Manager`; resource and system ids index its arrays.
+ * @param[in]     path     Path of the trace file.
+ * @return                 0 on success, -1 if the file cannot be created.
+ */
+int trace_open(EventTrace *trace, OutputWriter *writer, const Manager *manager, const char *path) {
+    TraceHeader header;
+
+    trace->stream = output_open(writer, path);
+    if (trace->stream == NULL) {
+        return -1;
+    }
+    trace->events = 0;
+    trace->bytes = 0;
+    trace_codec_init(&trace->codec, TRACE_TIME_UNIT_NS);
+    clock_gettime(CLOCK_MONOTONIC, &trace->start);
+
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.resource_count = (uint32_t)manager->resource_array.size;
+    header.system_count = (uint32_t)manager->system_array.size;
+    header.time_unit_ns = TRACE_TIME_UNIT_NS;
+    output_write(trace->stream, &header, sizeof(header));
+    for (int i = 0; i < manager->resource_array.size; i++) {
+        trace_write_name(trace, manager->resource_array.resources[i]->name);
+    }
+    for (int i = 0; i < manager->system_array.size; i++) {
+        trace_write_name(trace, manager->system_array.systems[i]->name);
+    }
+    return 0;
+}
+
+/**
+ * Appends one handled event to the trace.
+ *
+ * @param[in,out] trace  Pointer to the open `EventTrace`.
+ * @param[in]     event  Pointer to the `Event`.
+ */
+void trace_event(EventTrace *trace, const Event *event) {
+    TraceRecord record;
+    struct timespec now;
+    unsigned char encoded[TRACE_RECORD_MAX_BYTES];
+    int length;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record.time_ns = timespec_elapsed_ns(&trace->start, &now);
+    record.system = (int16_t)((event->system != NULL) ? event->system->id : -1);
+    record.resource = (int16_t)((event->resource != NULL) ? event->resource->id : -1);
+    record.status = (int16_t)event->status;
+    record.priority = (int16_t)event->priority;
+    record.amount = event->amount;
+    record.reserved = 0;
+    length = trace_encode(&trace->codec, &record, encoded);
+    output_write(trace->stream, encoded, length);
+    trace->events++;
+    trace->bytes += length;
+}
+
+/**
+ * Writes out the rest of the trace and closes its file.
+ *
+ * @param[in,out] trace  Pointer to the open `EventTrace`.
+ * @return               0 if the whole trace was written, otherwise the `errno` of the first failure.
+ */
+int trace_close(EventTrace *trace) {
+    int error = output_close(trace->stream);
+
+    trace->stream = NULL;
+    return error;
+}
+
+/**
+ * Writes a name as its length followed by its characters.
+ *
+ * @param[in,out] trace  Pointer to the open `EventTrace`.
+ * @param[in]     name   The name.
+ */
+static void trace_write_name(EventTrace *trace, const char *name) {
+    uint16_t length = (uint16_t)strlen(name);
+
+    output_write(trace->stream, &length, sizeof(length));
+    output_write(trace->stream, name, length);
+}
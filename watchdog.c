@@ -0,0 +1,221 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+/* Watchdog: a thread that notices systems and the manager that stop stepping */
+
+// Every system bumps its heartbeat once per step and the manager once per pass, and both
+// note what they are doing before each step that can block. Those are relaxed stores to
+// counters only their own thread writes. The watchdog reads them every WATCHDOG_INTERVAL
+// ms; anything whose heartbeat has not moved for WATCHDOG_MULTIPLE of its expected period
+// is reported once with what it was last doing, and again when it recovers. A system
+// sleeping towards a processing deadline that has not passed yet is on time, however
+// long its drawn processing time.
+
+static void *watchdog_thread(void *arg);
+static void watchdog_scan(Watchdog *watchdog);
+static long long watchdog_expected_ms(const Watchdog *watchdog, int index);
+static const char *watchdog_activity_name(int activity);
+
+/**
+ * Starts the watchdog thread for a run.
+ *
+ * The manager is only watched when it has its own thread.
+ *
+ * @param[out] watchdog  Pointer to the `Watchdog` to initialize.
+ * @param[in]  manager   Pointer to the running `Manager`.
+ */
+void watchdog_start(Watchdog *watchdog, Manager *manager) {
+    int count = manager->system_array.size + 1;
+
+    watchdog->manager = manager;
+    watchdog->count = count;
+    watchdog->alerts = 0;
+    watchdog->seen = (unsigned long *)calloc(count, sizeof(unsigned long));
+    watchdog->since = (struct timespec *)calloc(count, sizeof(struct timespec));
+    watchdog->flagged = (int *)calloc(count, sizeof(int));
+    if (watchdog->seen == NULL || watchdog->since == NULL || watchdog->flagged == NULL) {
+        fprintf(stderr, "Failed to allocate memory for Watchdog.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Nothing has stepped yet, so every heartbeat counts as fresh from the start of the run
+    for (int i = 0; i < count; i++) {
+        watchdog->seen[i] = (unsigned long)-1;
+        watchdog->since[i] = manager->start;
+    }
+
+    atomic_store(&watchdog->running, 1);
+    if (pthread_create(&watchdog->thread, NULL, watchdog_thread, watchdog) != 0) {
+        perror("Failed to create watchdog thread");
+        atomic_store(&watchdog->running, 0);
+    }
+}
+
+/**
+ * Stops the watchdog thread and frees its memory.
+ *
+ * @param[in,out] watchdog  Pointer to the `Watchdog`.
+ * @return                  Number of stalls it reported.
+ */
+long watchdog_stop(Watchdog *watchdog) {
+    if (atomic_exchange(&watchdog->running, 0)) {
+        pthread_join(watchdog->thread, NULL);
+    }
+    free(watchdog->seen);
+    free(watchdog->since);
+    free(watchdog->flagged);
+    watchdog->seen = NULL;
+    watchdog->since = NULL;
+    watchdog->flagged = NULL;
+    return watchdog->alerts;
+}
+
+/**
+ * Thread function for the watchdog.
+ *
+ * @param[in,out] arg  Pointer to the `Watchdog`.
+ * @return             NULL
+ */
+static void *watchdog_thread(void *arg) {
+    Watchdog *watchdog = (Watchdog *)arg;
+    struct timespec next;
+
+    flight_thread_start("watchdog");
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load(&watchdog->running)) {
+        timespec_add_ms(&next, WATCHDOG_INTERVAL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            // Interrupted by a signal, keep sleeping towards the same time
+        }
+
+        if (atomic_load(&watchdog->running) && atomic_load_explicit(&watchdog->manager->simulation_running, memory_order_relaxed)) {
+            watchdog_scan(watchdog);
+        }
+    }
+    flight_thread_stop();
+    return NULL;
+}
+
+/**
+ * Compares every heartbeat with the last one seen and reports stalls and recoveries.
+ *
+ * @param[in,out] watchdog  Pointer to the `Watchdog`.
+ */
+static void watchdog_scan(Watchdog *watchdog) {
+    Manager *manager = watchdog->manager;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < watchdog->count; i++) {
+        int is_manager = (i == watchdog->count - 1);
+        System *system = is_manager ? NULL : manager->system_array.systems[i];
+        unsigned long beat;
+        long long idle_ms, limit_ms;
+        int activity;
+
+        if (is_manager && manager->inline_manager) {
+            continue;
+        }
+        if (system != NULL && atomic_load_explicit(&system->status, memory_order_relaxed) == TERMINATE) {
+            continue;
+        }
+
+        beat = atomic_load_explicit(is_manager ? &manager->heartbeat : &system->heartbeat, memory_order_relaxed);
+        activity = atomic_load_explicit(is_manager ? &manager->activity : &system->activity, memory_order_relaxed);
+        idle_ms = timespec_elapsed_ns(&watchdog->since[i], &now) / 1000000LL;
+
+        if (beat != watchdog->seen[i]) {
+            if (watchdog->flagged[i]) {
+                fprintf(stderr, "Watchdog: %s%s recovered after %lld ms\n", is_manager ? "manager" : "system ",
+                        is_manager ? "" : system->name, idle_ms);
+                watchdog->flagged[i] = 0;
+            }
+            watchdog->seen[i] = beat;
+            watchdog->since[i] = now;
+            continue;
+        }
+
+        limit_ms = WATCHDOG_MULTIPLE * watchdog_expected_ms(watchdog, i);
+        if (limit_ms < WATCHDOG_MIN_MS) {
+            limit_ms = WATCHDOG_MIN_MS;
+        }
+        if (watchdog->flagged[i] || idle_ms < limit_ms) {
+            continue;
+        }
+
+        // A long processing time drawn from the system's distribution is not a stall
+        if (activity == ACTIVITY_PROCESSING && atomic_load_explicit(&system->deadline_ns, memory_order_relaxed) > timespec_to_ns(&now)) {
+            continue;
+        }
+
+        if (is_manager) {
+            fprintf(stderr, "Watchdog: manager has not completed a pass for %lld ms (expected within %lld ms), last %s\n",
+                    idle_ms, limit_ms, watchdog_activity_name(activity));
+        } else {
+            Resource *resource = (activity == ACTIVITY_STORING || activity == ACTIVITY_RETRYING)
+                                 ? system->produced.resource : system->consumed.resource;
+            int names_resource = (activity >= ACTIVITY_CONSUMING && activity <= ACTIVITY_RETRYING &&
+                                  activity != ACTIVITY_PROCESSING && resource != NULL);
+
+            fprintf(stderr, "Watchdog: system %s has not stepped for %lld ms (expected within %lld ms), last %s%s%s\n",
+                    system->name, idle_ms, limit_ms, watchdog_activity_name(activity),
+                    names_resource ? " " : "", names_resource ? resource->name : "");
+        }
+        flight_record(FLIGHT_WATCHDOG, is_manager ? -1 : system->id, activity, (int)idle_ms, (int)limit_ms, 0);
+        watchdog->flagged[i] = 1;
+        watchdog->alerts++;
+    }
+}
+
+/**
+ * The longest a healthy system step or manager pass is expected to take.
+ *
+ * @param[in] watchdog  Pointer to the `Watchdog`.
+ * @param[in] index     Index of the system, or `count - 1` for the manager.
+ * @return              The time in milliseconds.
+ */
+static long long watchdog_expected_ms(const Watchdog *watchdog, int index) {
+    const System *system;
+
+    if (index == watchdog->count - 1) {
+        return MANAGER_WAIT_TIME;
+    }
+
+    // A step may wait for input, process (twice as long when SLOW) and wait to retry a store
+    system = watchdog->manager->system_array.systems[index];
+    return 2 * SYSTEM_WAIT_TIME + 2LL * (system->processing_time + system->processing_spread);
+}
+
+/**
+ * Describes an `ACTIVITY_*` code for the watchdog's reports.
+ *
+ * @param[in] activity  The code.
+ * @return              A description, followed by the resource's name where one applies.
+ */
+static const char *watchdog_activity_name(int activity) {
+    switch (activity) {
+        case ACTIVITY_CONSUMING:
+            return "consuming";
+        case ACTIVITY_WAITING:
+            return "waiting for a producer of";
+        case ACTIVITY_PROCESSING:
+            return "processing";
+        case ACTIVITY_STORING:
+            return "storing into";
+        case ACTIVITY_RETRYING:
+            return "waiting to retry storing into";
+        case ACTIVITY_PUBLISHING:
+            return "publishing events";
+        case ACTIVITY_HANDLING:
+            return "handling events";
+        case ACTIVITY_CHECKING:
+            return "checking the run";
+        case ACTIVITY_SLEEPING:
+            return "sleeping between passes";
+        default:
+            return "starting";
+    }
+}
@@ -0,0 +1,632 @@
+#include "defs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Asynchronous output: traces and recordings reach the disk without their producers waiting */
+
+// Every stream owns two pages. The producer fills one while the other is written, and
+// only waits if it fills a page before the previous one is on disk. Full pages are
+// written through io_uring when the kernel has it: all pages are registered once, so
+// writes use fixed buffers, and pages from several streams are submitted together
+// with one io_uring_enter. A completion thread reaps finished writes, resubmits short
+// ones and hands the pages back. Without io_uring, the same thread takes the full pages
+// from a queue and writes them with pwrite.
+//
+// The producers and the completion thread share the submission ring and page states
+// under one lock. A producer holds it only to queue a page or wait for one.
+//
+// If io_uring_enter fails for good, the writer carries on with the pwrite thread. Entries
+// the kernel has not taken are removed from the ring and their pages written with pwrite.
+// Pages the kernel already has stay busy until their completions turn up in the ring,
+// which the thread polls without entering it, since the kernel may still be reading them.
+// The thread never waits longer than OUTPUT_REAP_WAIT_MS, so it notices the switch even
+// with nothing in flight.
+
+#define OUTPUT_STOP_TOKEN (~0ull)   // user_data of the NOP that wakes the completion thread to stop
+
+static int output_uring_setup(OutputWriter *writer);
+static void output_uring_teardown(OutputWriter *writer);
+static void output_uring_queue(OutputWriter *writer, OutputPage *page, uint64_t token);
+static void output_uring_submit(OutputWriter *writer);
+static int output_uring_reap(OutputWriter *writer);
+static void output_uring_complete(OutputWriter *writer, OutputPage *page, int result);
+static void output_uring_fail(OutputWriter *writer, int error);
+static void *output_thread(void *arg);
+static void output_queue_page(OutputStream *stream, int urgent);
+static void output_page_start(OutputWriter *writer, OutputPage *page);
+static void output_wait_page(OutputWriter *writer, OutputPage *page);
+static void output_page_done(OutputWriter *writer, OutputPage *page, int error);
+
+/**
+ * Sets up an `OutputWriter` and starts its completion thread.
+ *
+ * Falls back to a pwrite thread if io_uring is not wanted or the kernel refuses it.
+ *
+ * @param[out] writer     Pointer to the `OutputWriter` to initialize.
+ * @param[in]  use_uring  Non-zero to write through io_uring when it is available.
+ */
+void output_init(OutputWriter *writer, int use_uring) {
+    memset(writer, 0, sizeof(OutputWriter));
+    writer->ring_fd = -1;
+
+    writer->memory = (unsigned char *)aligned_alloc(4096, (size_t)OUTPUT_PAGE_COUNT * OUTPUT_PAGE_SIZE);
+    if (writer->memory == NULL) {
+        fprintf(stderr, "Failed to allocate memory for OutputWriter pages.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < OUTPUT_PAGE_COUNT; i++) {
+        writer->pages[i].data = writer->memory + (size_t)i * OUTPUT_PAGE_SIZE;
+        writer->pages[i].index = i;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->done, NULL);
+    pthread_cond_init(&writer->work, NULL);
+
+    writer->use_uring = use_uring && output_uring_setup(writer) == 0;
+    if (pthread_create(&writer->thread, NULL, output_thread, writer) != 0) {
+        perror("Failed to create output thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Stops the completion thread and frees the writer. Every stream must be closed first.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ */
+void output_clean(OutputWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = 1;
+    if (writer->use_uring) {
+        output_uring_queue(writer, NULL, OUTPUT_STOP_TOKEN);
+        output_uring_submit(writer);
+    } else {
+        pthread_cond_signal(&writer->work);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    if (writer->ring_fd >= 0) {
+        output_uring_teardown(writer);
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->done);
+    pthread_cond_destroy(&writer->work);
+    free(writer->memory);
+    writer->memory = NULL;
+}
+
+/**
+ * Describes how an `OutputWriter` reaches the disk.
+ *
+ * @param[in] writer  Pointer to the `OutputWriter`.
+ * @return            A short description.
+ */
+const char *output_backend_name(const OutputWriter *writer) {
+    if (!writer->use_uring) {
+        return "pwrite thread";
+    }
+    return writer->registered ? "io_uring, registered buffers" : "io_uring";
+}
+
+/**
+ * Creates (or truncates) a file and opens a stream writing to it.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in]     path    Path of the file.
+ * @return                The stream, or NULL if the file cannot be created or every stream is in use.
+ */
+OutputStream *output_open(OutputWriter *writer, const char *path) {
+    OutputStream *stream = NULL;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    for (int i = 0; i < OUTPUT_MAX_STREAMS && stream == NULL; i++) {
+        if (writer->streams[i].writer == NULL) {
+            stream = &writer->streams[i];
+            memset(stream, 0, sizeof(OutputStream));
+            stream->writer = writer;
+            stream->fd = fd;
+            stream->pages[0] = &writer->pages[2 * i];
+            stream->pages[1] = &writer->pages[2 * i + 1];
+            stream->pages[0]->stream = stream;
+            stream->pages[1]->stream = stream;
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    if (stream == NULL) {
+        close(fd);
+        errno = EMFILE;
+    }
+    return stream;
+}
+
+/**
+ * Appends bytes to a stream. Only one thread at a time may write to a stream.
+ *
+ * Copies into the current page and only waits if both pages are full.
+ *
+ * @param[in,out] stream  Pointer to the `OutputStream`.
+ * @param[in]     data    The bytes.
+ * @param[in]     size    Number of bytes.
+ */
+void output_write(OutputStream *stream, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    while (size > 0) {
+        size_t room = OUTPUT_PAGE_SIZE - stream->fill;
+        size_t count = (size < room) ? size : room;
+
+        memcpy(stream->pages[stream->current]->data + stream->fill, bytes, count);
+        stream->fill += count;
+        bytes += count;
+        size -= count;
+        if (stream->fill == OUTPUT_PAGE_SIZE) {
+            output_queue_page(stream, 0);
+        }
+    }
+}
+
+/**
+ * Hands the stream's partly filled page to the disk now instead of when it fills.
+ *
+ * Does not wait for the write to finish.
+ *
+ * @param[in,out] stream  Pointer to the `OutputStream`.
+ */
+void output_flush(OutputStream *stream) {
+    if (stream->fill > 0) {
+        output_queue_page(stream, 1);
+    }
+}
+
+/**
+ * Writes out whatever is left, waits for every write of the stream and closes its file.
+ *
+ * @param[in,out] stream  Pointer to the `OutputStream`.
+ * @return                0 if everything was written, otherwise the `errno` of the first failure.
+ */
+int output_close(OutputStream *stream) {
+    OutputWriter *writer = stream->writer;
+    int error;
+
+    output_flush(stream);
+    output_wait_page(writer, stream->pages[0]);
+    output_wait_page(writer, stream->pages[1]);
+    if (close(stream->fd) != 0 && stream->error == 0) {
+        stream->error = errno;
+    }
+    error = stream->error;
+
+    pthread_mutex_lock(&writer->lock);
+    stream->writer = NULL;
+    pthread_mutex_unlock(&writer->lock);
+    return error;
+}
+
+/**
+ * Queues the stream's current page to be written and switches to the other one.
+ *
+ * Writes are batched: io_uring is entered once `OUTPUT_SUBMIT_BATCH` pages are queued,
+ * when `urgent` is set, or when a producer needs a queued page back.
+ *
+ * @param[in,out] stream  Pointer to the `OutputStream`.
+ * @param[in]     urgent  Non-zero to start the write now.
+ */
+static void output_queue_page(OutputStream *stream, int urgent) {
+    OutputWriter *writer = stream->writer;
+    OutputPage *page = stream->pages[stream->current];
+
+    page->size = stream->fill;
+    page->done = 0;
+    page->offset = stream->offset;
+    stream->offset += (long long)stream->fill;
+    stream->bytes += (long long)stream->fill;
+
+    pthread_mutex_lock(&writer->lock);
+    page->busy = 1;
+    writer->writes++;
+    output_page_start(writer, page);
+    if (writer->use_uring && (urgent || writer->queued >= OUTPUT_SUBMIT_BATCH)) {
+        output_uring_submit(writer);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    stream->current ^= 1;
+    stream->fill = 0;
+    output_wait_page(writer, stream->pages[stream->current]);
+}
+
+/**
+ * Starts writing the unwritten part of a page, on the io_uring or through the pwrite
+ * thread. The writer's lock must be held.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in,out] page    The page.
+ */
+static void output_page_start(OutputWriter *writer, OutputPage *page) {
+    if (writer->use_uring) {
+        output_uring_queue(writer, page, (uint64_t)page->index);
+    } else {
+        writer->backlog[writer->backlog_tail++ % OUTPUT_PAGE_COUNT] = page;
+        pthread_cond_signal(&writer->work);
+    }
+}
+
+/**
+ * Waits until a page is written and can be filled again.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in]     page    The page.
+ */
+static void output_wait_page(OutputWriter *writer, OutputPage *page) {
+    pthread_mutex_lock(&writer->lock);
+    if (page->busy) {
+        writer->waits++;
+
+        // The page may still be sitting in the submission queue, waiting for a batch
+        if (writer->use_uring && writer->queued > 0) {
+            output_uring_submit(writer);
+        }
+        while (page->busy) {
+            pthread_cond_wait(&writer->done, &writer->lock);
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/**
+ * Marks a page written and wakes producers waiting for it. The writer's lock must be held.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in,out] page    The page.
+ * @param[in]     error   `errno` of a failed write, zero on success.
+ */
+static void output_page_done(OutputWriter *writer, OutputPage *page, int error) {
+    if (error != 0 && page->stream->error == 0) {
+        page->stream->error = error;
+    }
+    page->busy = 0;
+    pthread_cond_broadcast(&writer->done);
+}
+
+/**
+ * Completion thread: reaps io_uring completions, or writes queued pages with pwrite.
+ *
+ * @param[in,out] arg  Pointer to the `OutputWriter`.
+ * @return             NULL
+ */
+static void *output_thread(void *arg) {
+    OutputWriter *writer = (OutputWriter *)arg;
+    int stop = 0, use_uring;
+
+    while (!stop) {
+        pthread_mutex_lock(&writer->lock);
+        use_uring = writer->use_uring;
+        pthread_mutex_unlock(&writer->lock);
+
+        if (use_uring) {
+            struct __kernel_timespec timeout = {0, OUTPUT_REAP_WAIT_MS * 1000000LL};
+            struct io_uring_getevents_arg wait;
+            int error = 0;
+
+            memset(&wait, 0, sizeof(wait));
+            wait.ts = (uint64_t)(uintptr_t)&timeout;
+            if (syscall(__NR_io_uring_enter, writer->ring_fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &wait, sizeof(wait)) < 0 &&
+                errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME) {
+                error = errno;
+            }
+
+            // A producer may have given up on io_uring while this thread was waiting,
+            // reaping then hands any rest of a page to the pwrite thread instead
+            pthread_mutex_lock(&writer->lock);
+            if (error != 0) {
+                output_uring_fail(writer, error);
+            }
+            stop = output_uring_reap(writer);
+
+            // Short writes were queued again, start them rather than wait for a batch
+            if (writer->use_uring && writer->queued > 0) {
+                output_uring_submit(writer);
+            }
+            pthread_mutex_unlock(&writer->lock);
+        } else {
+            OutputPage *page;
+            int error = 0;
+
+            pthread_mutex_lock(&writer->lock);
+            while (writer->backlog_head == writer->backlog_tail) {
+                if (writer->in_ring > 0) {
+                    // io_uring failed with writes in flight, their completions still arrive in the ring
+                    output_uring_reap(writer);
+                    if (writer->backlog_head == writer->backlog_tail && writer->in_ring > 0) {
+                        struct timespec deadline;
+
+                        clock_gettime(CLOCK_REALTIME, &deadline);
+                        timespec_add_ms(&deadline, OUTPUT_REAP_WAIT_MS);
+                        pthread_cond_timedwait(&writer->work, &writer->lock, &deadline);
+                    }
+                } else if (writer->stopping) {
+                    break;
+                } else {
+                    pthread_cond_wait(&writer->work, &writer->lock);
+                }
+            }
+            if (writer->backlog_head == writer->backlog_tail) {
+                pthread_mutex_unlock(&writer->lock);
+                break;
+            }
+            page = writer->backlog[writer->backlog_head++ % OUTPUT_PAGE_COUNT];
+            writer->submit_calls++;
+            pthread_mutex_unlock(&writer->lock);
+
+            while (page->done < page->size && error == 0) {
+                ssize_t written = pwrite(page->stream->fd, page->data + page->done, page->size - page->done,
+                                         (off_t)(page->offset + (long long)page->done));
+                if (written > 0) {
+                    page->done += (size_t)written;
+                } else if (written < 0 && errno != EINTR) {
+                    error = errno;
+                }
+            }
+
+            pthread_mutex_lock(&writer->lock);
+            output_page_done(writer, page, error);
+            pthread_mutex_unlock(&writer->lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Takes every completion off the ring. The writer's lock must be held.
+ *
+ * Completions for pages without an entry on the ring are stale and dropped.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @return                Non-zero if the stop NOP completed.
+ */
+static int output_uring_reap(OutputWriter *writer) {
+    unsigned head = *writer->cq_head;
+    unsigned tail = __atomic_load_n(writer->cq_tail, __ATOMIC_ACQUIRE);
+    int stop = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &((struct io_uring_cqe *)writer->cqes)[head & *writer->cq_mask];
+
+        if (cqe->user_data == OUTPUT_STOP_TOKEN) {
+            stop = 1;
+        } else if (writer->pages[cqe->user_data].in_ring) {
+            writer->pages[cqe->user_data].in_ring = 0;
+            writer->in_ring--;
+            output_uring_complete(writer, &writer->pages[cqe->user_data], cqe->res);
+        }
+        head++;
+    }
+    __atomic_store_n(writer->cq_head, head, __ATOMIC_RELEASE);
+    return stop;
+}
+
+/**
+ * Handles the completion of one page write, starting the rest again after a short write.
+ * The writer's lock must be held.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in,out] page    The page.
+ * @param[in]     result  The completion's result: bytes written or a negative `errno`.
+ */
+static void output_uring_complete(OutputWriter *writer, OutputPage *page, int result) {
+    if (result == -EINTR || result == -EAGAIN) {
+        output_page_start(writer, page);
+        return;
+    }
+    if (result < 0) {
+        output_page_done(writer, page, -result);
+        return;
+    }
+    if (result == 0) {
+        output_page_done(writer, page, EIO);
+        return;
+    }
+
+    page->done += (size_t)result;
+    if (page->done < page->size) {
+        output_page_start(writer, page);
+    } else {
+        output_page_done(writer, page, 0);
+    }
+}
+
+/**
+ * Gives up on io_uring after `io_uring_enter` failed for good. The writer's lock must be held.
+ *
+ * Entries the kernel has not taken are removed from the submission ring and their pages
+ * handed to the pwrite thread. Pages the kernel has taken stay busy until their
+ * completions are reaped, since it may still be reading them.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in]     error   `errno` of the failure.
+ */
+static void output_uring_fail(OutputWriter *writer, int error) {
+    unsigned tail = *writer->sq_tail;
+
+    if (!writer->use_uring) {
+        return;
+    }
+    fprintf(stderr, "io_uring_enter: %s, writing with pwrite from now on\n", strerror(error));
+    writer->use_uring = 0;
+
+    // The last `queued` entries before the tail were never submitted
+    for (int i = 1; i <= writer->queued; i++) {
+        struct io_uring_sqe *sqe = &((struct io_uring_sqe *)writer->sqes)[(tail - i) & *writer->sq_mask];
+
+        if (sqe->user_data != OUTPUT_STOP_TOKEN) {
+            writer->pages[sqe->user_data].in_ring = 0;
+            writer->in_ring--;
+            output_page_start(writer, &writer->pages[sqe->user_data]);
+        }
+    }
+    __atomic_store_n(writer->sq_tail, tail - (unsigned)writer->queued, __ATOMIC_RELEASE);
+    writer->queued = 0;
+    pthread_cond_signal(&writer->work);
+}
+
+/**
+ * Sets up the io_uring instance and registers every page as a fixed buffer.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`, with its pages allocated.
+ * @return                0 on success, -1 if io_uring cannot be used.
+ */
+static int output_uring_setup(OutputWriter *writer) {
+    struct io_uring_params params;
+    struct iovec buffers[OUTPUT_PAGE_COUNT];
+    unsigned char *sq, *cq;
+    size_t sq_size, cq_size;
+    int fd;
+
+    memset(&params, 0, sizeof(params));
+    fd = (int)syscall(__NR_io_uring_setup, OUTPUT_QUEUE_DEPTH, &params);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // The completion thread needs to wait with a timeout, see output_thread
+    if (!(params.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return -1;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+    }
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq
+         : mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    writer->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || writer->sqes == MAP_FAILED) {
+        if (sq != MAP_FAILED) {
+            munmap(sq, sq_size);
+        }
+        if (cq != MAP_FAILED && cq != sq) {
+            munmap(cq, cq_size);
+        }
+        if (writer->sqes != MAP_FAILED) {
+            munmap(writer->sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        }
+        close(fd);
+        return -1;
+    }
+
+    writer->ring_fd = fd;
+    writer->sq_ring = sq;
+    writer->cq_ring = cq;
+    writer->sq_ring_size = sq_size;
+    writer->cq_ring_size = cq_size;
+    writer->sq_entries = params.sq_entries;
+    writer->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    writer->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    writer->sq_array = (unsigned *)(sq + params.sq_off.array);
+    writer->cq_head = (unsigned *)(cq + params.cq_off.head);
+    writer->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    writer->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    writer->cqes = cq + params.cq_off.cqes;
+
+    // Fixed buffers save pinning the pages on every write; plain writes still work without them
+    for (int i = 0; i < OUTPUT_PAGE_COUNT; i++) {
+        buffers[i].iov_base = writer->pages[i].data;
+        buffers[i].iov_len = OUTPUT_PAGE_SIZE;
+    }
+    writer->registered = (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, OUTPUT_PAGE_COUNT) == 0);
+    return 0;
+}
+
+/**
+ * Unmaps the rings and closes the io_uring instance.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ */
+static void output_uring_teardown(OutputWriter *writer) {
+    munmap(writer->sqes, writer->sq_entries * sizeof(struct io_uring_sqe));
+    if (writer->cq_ring != writer->sq_ring) {
+        munmap(writer->cq_ring, writer->cq_ring_size);
+    }
+    munmap(writer->sq_ring, writer->sq_ring_size);
+    close(writer->ring_fd);
+    writer->ring_fd = -1;
+}
+
+/**
+ * Adds a write of the unwritten part of a page, or a NOP for `page == NULL`, to the
+ * submission ring without entering the kernel. The writer's lock must be held.
+ *
+ * There is an entry for every page plus the stop NOP, so the ring never overflows.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ * @param[in]     page    The page, or NULL.
+ * @param[in]     token   Returned in the completion's user_data.
+ */
+static void output_uring_queue(OutputWriter *writer, OutputPage *page, uint64_t token) {
+    unsigned tail = *writer->sq_tail;
+    unsigned index = tail & *writer->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)writer->sqes)[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    if (page == NULL) {
+        sqe->opcode = IORING_OP_NOP;
+    } else {
+        sqe->opcode = writer->registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = page->stream->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(page->data + page->done);
+        sqe->len = (uint32_t)(page->size - page->done);
+        sqe->off = (uint64_t)(page->offset + (long long)page->done);
+        sqe->buf_index = (uint16_t)page->index;
+    }
+    sqe->user_data = token;
+    if (page != NULL) {
+        page->in_ring = 1;
+        writer->in_ring++;
+    }
+
+    writer->sq_array[index] = index;
+    __atomic_store_n(writer->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    writer->queued++;
+}
+
+/**
+ * Submits every queued entry with one `io_uring_enter`. The writer's lock must be held.
+ *
+ * @param[in,out] writer  Pointer to the `OutputWriter`.
+ */
+static void output_uring_submit(OutputWriter *writer) {
+    while (writer->queued > 0) {
+        long submitted = syscall(__NR_io_uring_enter, writer->ring_fd, writer->queued, 0, 0, NULL, 0);
+
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            output_uring_fail(writer, errno);
+            return;
+        }
+        writer->queued -= (int)submitted;
+        writer->submit_calls++;
+    }
+}